@@ -8,6 +8,51 @@
 
 namespace dae
 {
+	//Snapshot of the input the camera reacts to, sampled on the main thread (SDL event thread)
+	struct CameraInput
+	{
+		bool moveForward{ false };
+		bool moveBackward{ false };
+		bool moveRight{ false };
+		bool moveLeft{ false };
+
+		int mouseX{};
+		int mouseY{};
+		uint32_t mouseState{};
+
+		static CameraInput Sample()
+		{
+			CameraInput input{};
+
+			const uint8_t* pKeyboardState = SDL_GetKeyboardState(nullptr);
+			input.moveForward = pKeyboardState[SDL_SCANCODE_W];
+			input.moveBackward = pKeyboardState[SDL_SCANCODE_S];
+			input.moveRight = pKeyboardState[SDL_SCANCODE_D];
+			input.moveLeft = pKeyboardState[SDL_SCANCODE_A];
+
+			input.mouseState = SDL_GetRelativeMouseState(&input.mouseX, &input.mouseY);
+			return input;
+		}
+
+		bool IsActive() const
+		{
+			return moveForward || moveBackward || moveRight || moveLeft || mouseX != 0 || mouseY != 0;
+		}
+
+		//Merge a newer sample into this one: keys and buttons take the latest state, mouse movement adds up
+		void Accumulate(const CameraInput& newer)
+		{
+			moveForward = newer.moveForward;
+			moveBackward = newer.moveBackward;
+			moveRight = newer.moveRight;
+			moveLeft = newer.moveLeft;
+
+			mouseX += newer.mouseX;
+			mouseY += newer.mouseY;
+			mouseState = newer.mouseState;
+		}
+	};
+
 	struct Camera
 	{
 		Camera() = default;
@@ -34,6 +79,11 @@ namespace dae
 
 		Matrix cameraToWorld{};
 
+		CameraInput input{};
+
+		//Bumped whenever the camera actually moves, used for change tracking
+		uint32_t version{};
+
 
 		Matrix CalculateCameraToWorld()
 		{
@@ -54,31 +104,27 @@ namespace dae
 		{
 			const float deltaTime = pTimer->GetElapsed();
 
-			//Keyboard Input
-			const uint8_t* pKeyboardState = SDL_GetKeyboardState(nullptr);
-
-
-			//Mouse Input
-			int mouseX{}, mouseY{};
-			const uint32_t mouseState = SDL_GetRelativeMouseState(&mouseX, &mouseY);
+			//Input is sampled by the main thread and handed over right before the frame starts
+			const int mouseX{ input.mouseX }, mouseY{ input.mouseY };
+			const uint32_t mouseState{ input.mouseState };
 
 			// Keyboard
-			if (pKeyboardState[SDL_SCANCODE_W])
+			if (input.moveForward)
 			{
 				origin += forward * movementSpeed * deltaTime;
 				updateONB = true;
 			}
-			if (pKeyboardState[SDL_SCANCODE_S])
+			if (input.moveBackward)
 			{
 				origin -= forward * movementSpeed * deltaTime;
 				updateONB = true;
 			}
-			if (pKeyboardState[SDL_SCANCODE_D])
+			if (input.moveRight)
 			{
 				origin += right * movementSpeed * deltaTime;
 				updateONB = true;
 			}
-			if (pKeyboardState[SDL_SCANCODE_A])
+			if (input.moveLeft)
 			{
 				origin -= right * movementSpeed * deltaTime;
 				updateONB = true;
@@ -112,6 +158,11 @@ namespace dae
 
 				updateONB = true;
 			}
+
+			//Holding a button without moving the mouse does not count as a change
+			const bool isMouseMoving{ (mouseState & (SDL_BUTTON(SDL_BUTTON_LEFT) | SDL_BUTTON(SDL_BUTTON_RIGHT))) && (mouseX != 0 || mouseY != 0) };
+			if (input.moveForward || input.moveBackward || input.moveRight || input.moveLeft || isMouseMoving)
+				++version;
 		}
 	};
 }
@@ -0,0 +1,111 @@
+#include "CpuTopology.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <string>
+#include <thread>
+
+using namespace dae;
+
+#if defined(__linux__)
+namespace
+{
+	//"0-3,8,10-11" as written by the kernel for cpu and node lists
+	std::vector<int> ParseCpuList(const std::string& list)
+	{
+		std::vector<int> ids{};
+		size_t start{};
+		while (start < list.size())
+		{
+			const size_t end{ std::min(list.find(',', start), list.size()) };
+			const std::string range{ list.substr(start, end - start) };
+			const size_t dash{ range.find('-') };
+			if (!range.empty() && isdigit(range[0]))
+			{
+				const int first{ std::stoi(range) };
+				const int last{ dash == std::string::npos ? first : std::stoi(range.substr(dash + 1)) };
+				for (int id{ first }; id <= last; ++id)
+					ids.push_back(id);
+			}
+			start = end + 1;
+		}
+		return ids;
+	}
+
+	bool ReadLine(const std::string& path, std::string& line)
+	{
+		std::ifstream fileStream(path);
+		return fileStream && std::getline(fileStream, line);
+	}
+}
+#endif
+
+std::vector<LogicalCpu> CpuTopology::GetWorkerCpus(bool excludeSmtSiblings) const
+{
+	std::vector<LogicalCpu> workerCpus{};
+	for (const LogicalCpu& cpu : cpus)
+	{
+		const bool isSibling{ std::any_of(workerCpus.begin(), workerCpus.end(), [&cpu](const LogicalCpu& other)
+			{
+				return other.package == cpu.package && other.core == cpu.core;
+			}) };
+		if (!excludeSmtSiblings || !isSibling)
+			workerCpus.push_back(cpu);
+	}
+
+	std::stable_sort(workerCpus.begin(), workerCpus.end(), [](const LogicalCpu& a, const LogicalCpu& b) { return a.node < b.node; });
+	return workerCpus;
+}
+
+CpuTopology CpuTopology::Detect()
+{
+	CpuTopology topology{};
+
+#if defined(__linux__)
+	const std::string cpuPath{ "/sys/devices/system/cpu/" };
+	std::string line{};
+	if (ReadLine(cpuPath + "online", line))
+	{
+		for (const int id : ParseCpuList(line))
+		{
+			LogicalCpu cpu{ id, id, 0, 0 };
+			const std::string topologyPath{ cpuPath + "cpu" + std::to_string(id) + "/topology/" };
+			if (ReadLine(topologyPath + "core_id", line)) cpu.core = std::stoi(line);
+			if (ReadLine(topologyPath + "physical_package_id", line)) cpu.package = std::stoi(line);
+			topology.cpus.push_back(cpu);
+		}
+
+		//Node ids can have gaps, they are numbered densely. Nodes without CPUs (memory only) are skipped.
+		const std::string nodePath{ "/sys/devices/system/node/" };
+		int nrNodes{};
+		const std::vector<int> nodeIds{ ReadLine(nodePath + "online", line) ? ParseCpuList(line) : std::vector<int>{} };
+		for (const int nodeId : nodeIds)
+		{
+			if (!ReadLine(nodePath + "node" + std::to_string(nodeId) + "/cpulist", line))
+				continue;
+
+			const std::vector<int> nodeCpus{ ParseCpuList(line) };
+			if (nodeCpus.empty())
+				continue;
+
+			for (LogicalCpu& cpu : topology.cpus)
+			{
+				if (std::find(nodeCpus.begin(), nodeCpus.end(), cpu.id) != nodeCpus.end())
+					cpu.node = nrNodes;
+			}
+			++nrNodes;
+		}
+		topology.nrNodes = std::max(nrNodes, 1);
+	}
+#endif
+
+	if (topology.cpus.empty())
+	{
+		const int nrCpus{ std::max(int(std::thread::hardware_concurrency()), 1) };
+		for (int id{}; id < nrCpus; ++id)
+			topology.cpus.push_back({ id, id, 0, 0 });
+		topology.nrNodes = 1;
+	}
+
+	return topology;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <vector>
+
+namespace dae
+{
+	struct LogicalCpu
+	{
+		int id{};
+		//Physical core and socket, SMT siblings share both
+		int core{};
+		int package{};
+		//Dense NUMA node index, [0, CpuTopology::nrNodes)
+		int node{};
+	};
+
+	//Logical CPUs of the machine, read from /sys on Linux.
+	//Elsewhere every hardware thread counts as its own core on a single node.
+	struct CpuTopology
+	{
+		std::vector<LogicalCpu> cpus{};
+		int nrNodes{ 1 };
+
+		//One CPU per render worker, grouped by node. Without SMT siblings only the first thread of every core is used.
+		std::vector<LogicalCpu> GetWorkerCpus(bool excludeSmtSiblings) const;
+
+		static CpuTopology Detect();
+	};
+}
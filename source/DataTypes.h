@@ -1,5 +1,6 @@
 #pragma once
 #include <cassert>
+#include <cstdint>
 
 #include "Math.h"
 #include "vector"
@@ -93,6 +94,10 @@ namespace dae
 		std::vector<Vector3> transformedPositions{};
 		std::vector<Vector3> transformedNormals{};
 
+		//Bumped whenever the world transform changes, used for change tracking
+		Matrix worldTransform{};
+		uint32_t version{};
+
 		void Translate(const Vector3& translation)
 		{
 			translationTransform = Matrix::CreateTranslation(translation);
@@ -157,6 +162,13 @@ namespace dae
 			//Calculate Final Transform 
 			const Matrix finalTransform{ scaleTransform * rotationTransform * translationTransform };
 
+			//Nothing moved, the transformed data is still valid
+			if (finalTransform == worldTransform && transformedPositions.size() == positions.size() && transformedNormals.size() == normals.size())
+				return;
+
+			worldTransform = finalTransform;
+			++version;
+
 			//Transform Positions (positions > transformedPositions)
 			transformedPositions.clear();
 			transformedPositions.reserve(positions.size());
@@ -227,14 +239,26 @@ namespace dae
 	enum class LightType
 	{
 		Point,
-		Directional
+		Directional,
+		//Area lights, sampled with several shadow rays for soft shadows
+		Sphere,
+		Rectangle,
+		Disc
 	};
 
 	struct Light
 	{
+		//Centre of area lights
 		Vector3 origin{};
+		//Emitting side of rectangles and discs
 		Vector3 direction{};
+		//Half edges of rectangles
+		Vector3 axisU{};
+		Vector3 axisV{};
+		//Spheres and discs
+		float radius{};
 		ColorRGB color{};
+		//Area lights emit like a point light of this intensity at their centre, rectangles and discs fall off with the cosine
 		float intensity{};
 
 		LightType type{};
@@ -258,6 +282,8 @@ namespace dae
 
 		bool didHit{ false };
 		unsigned char materialIndex{ 0 };
+		//Index over all planes, spheres and meshes of the scene (in that order), a mesh counts as one primitive
+		uint32_t primitiveIndex{};
 	};
 #pragma endregion
 }
\ No newline at end of file
@@ -0,0 +1,46 @@
+#include "DynamicResolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace dae;
+
+float DynamicResolution::Update(float frameTime)
+{
+	//Frames right after a scale change still pay for the switch (full re-render), skip them
+	if (m_FramesToSettle > 0)
+	{
+		--m_FramesToSettle;
+		m_FilteredFrameTime = frameTime;
+		return m_Scale;
+	}
+
+	//Exponential moving average to ignore single spikes
+	m_FilteredFrameTime = (m_FilteredFrameTime > 0.f) ? m_FilteredFrameTime * .8f + frameTime * .2f : frameTime;
+
+	const float lowerBound{ m_TargetFrameTime * (1.f - m_Hysteresis) };
+	const float upperBound{ m_TargetFrameTime * (1.f + m_Hysteresis) };
+	if (m_FilteredFrameTime >= lowerBound && m_FilteredFrameTime <= upperBound)
+		return m_Scale;
+
+	//Cost scales with the pixel count, so with the square of the per-axis scale
+	const float desiredScale{ m_Scale * sqrtf(m_TargetFrameTime / m_FilteredFrameTime) };
+	const float limitedScale{ std::clamp(desiredScale, m_Scale - MAX_SCALE_CHANGE, m_Scale + MAX_SCALE_CHANGE) };
+
+	//Fine, fixed steps so small fluctuations map to the same resolution
+	const float newScale{ std::clamp(roundf(limitedScale / SCALE_STEP) * SCALE_STEP, MIN_SCALE, 1.f) };
+	if (newScale != m_Scale)
+	{
+		m_Scale = newScale;
+		m_FramesToSettle = SETTLE_FRAMES;
+	}
+
+	return m_Scale;
+}
+
+void DynamicResolution::Reset()
+{
+	m_Scale = 1.f;
+	m_FilteredFrameTime = 0.f;
+	m_FramesToSettle = 0;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+namespace dae
+{
+	//Adjusts the internal render resolution so the frame time stays close to a target
+	class DynamicResolution final
+	{
+	public:
+		DynamicResolution() = default;
+		~DynamicResolution() = default;
+
+		DynamicResolution(const DynamicResolution&) = delete;
+		DynamicResolution(DynamicResolution&&) noexcept = delete;
+		DynamicResolution& operator=(const DynamicResolution&) = delete;
+		DynamicResolution& operator=(DynamicResolution&&) noexcept = delete;
+
+		/**
+		 * \brief Feed the time of a rendered frame, returns the scale to use for the next frames
+		 * \param frameTime duration of the last rendered frame in seconds
+		 * \return scale per axis of the internal resolution [MinScale, 1]
+		 */
+		float Update(float frameTime);
+		void Reset();
+
+		void SetTargetFrameTime(float seconds) { m_TargetFrameTime = seconds; }
+		//Fraction around the target in which the scale is left alone, prevents oscillation
+		void SetHysteresis(float fraction) { m_Hysteresis = fraction; }
+
+		float GetTargetFrameTime() const { return m_TargetFrameTime; }
+		float GetScale() const { return m_Scale; }
+
+	private:
+		static constexpr float MIN_SCALE{ .25f };
+		static constexpr float SCALE_STEP{ .025f };
+		static constexpr float MAX_SCALE_CHANGE{ .1f };
+		static constexpr int SETTLE_FRAMES{ 3 };
+
+		float m_TargetFrameTime{ 1.f / 30.f };
+		float m_Hysteresis{ .1f };
+
+		float m_Scale{ 1.f };
+		float m_FilteredFrameTime{};
+		int m_FramesToSettle{};
+	};
+}
@@ -0,0 +1,118 @@
+#include "LightTree.h"
+#include <algorithm>
+#include "DataTypes.h"
+#include "Utils.h"
+
+using namespace dae;
+
+void LightTree::Build(const std::vector<Light>& lights)
+{
+	m_Nodes.clear();
+	m_DirectionalLights.clear();
+
+	//Lights without power never contribute, they are left out of the tree
+	std::vector<uint32_t> pointLights{};
+	for (uint32_t lightIndex{}; lightIndex < lights.size(); ++lightIndex)
+	{
+		const Light& light{ lights[lightIndex] };
+		if (light.type == LightType::Directional)
+			m_DirectionalLights.push_back(lightIndex);
+		else if (light.intensity > 0.f)
+			pointLights.push_back(lightIndex);
+	}
+
+	m_NrPointLights = uint32_t(pointLights.size());
+	if (pointLights.empty())
+		return;
+
+	m_Nodes.reserve(pointLights.size() * 2 - 1);
+	BuildNode(lights, pointLights.begin(), pointLights.end());
+}
+
+uint32_t LightTree::BuildNode(const std::vector<Light>& lights, std::vector<uint32_t>::iterator first, std::vector<uint32_t>::iterator last)
+{
+	const uint32_t nodeIndex{ uint32_t(m_Nodes.size()) };
+	m_Nodes.emplace_back();
+
+	//Area lights are bounded by their extent around the centre, so the box holds every point that can be sampled on them
+	Node node{ lights[*first].origin, lights[*first].origin, 0.f, 0, *first };
+	for (auto it{ first }; it != last; ++it)
+	{
+		const Light& light{ lights[*it] };
+		const float extent{ LightUtils::GetExtent(light) };
+		const Vector3 halfSize{ extent, extent, extent };
+		node.minAABB = Vector3::Min(node.minAABB, light.origin - halfSize);
+		node.maxAABB = Vector3::Max(node.maxAABB, light.origin + halfSize);
+		node.power += light.intensity * (light.color.r + light.color.g + light.color.b) / 3.f;
+	}
+
+	if (last - first > 1)
+	{
+		//Median split along the longest axis keeps the tree balanced
+		const Vector3 extent{ node.maxAABB - node.minAABB };
+		const int axis{ extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2) };
+		const auto middle{ first + (last - first) / 2 };
+		std::nth_element(first, middle, last, [&lights, axis](uint32_t a, uint32_t b) { return lights[a].origin[axis] < lights[b].origin[axis]; });
+
+		BuildNode(lights, first, middle);
+		node.secondChild = BuildNode(lights, middle, last);
+	}
+
+	m_Nodes[nodeIndex] = node;
+	return nodeIndex;
+}
+
+bool LightTree::Sample(const Vector3& position, const Vector3& normal, float u, uint32_t& lightIndex, float& pdf) const
+{
+	if (m_Nodes.empty() || GetImportance(m_Nodes[0], position, normal) <= 0.f)
+		return false;
+
+	pdf = 1.f;
+	uint32_t nodeIndex{};
+	while (m_Nodes[nodeIndex].secondChild != 0)
+	{
+		const uint32_t firstChild{ nodeIndex + 1 }, secondChild{ m_Nodes[nodeIndex].secondChild };
+		const float firstImportance{ GetImportance(m_Nodes[firstChild], position, normal) };
+		const float totalImportance{ firstImportance + GetImportance(m_Nodes[secondChild], position, normal) };
+		if (totalImportance <= 0.f)
+			return false;
+
+		//Reuse what is left of u for the next level
+		const float firstProbability{ firstImportance / totalImportance };
+		if (u < firstProbability)
+		{
+			u /= firstProbability;
+			pdf *= firstProbability;
+			nodeIndex = firstChild;
+		}
+		else
+		{
+			u = (u - firstProbability) / (1.f - firstProbability);
+			pdf *= 1.f - firstProbability;
+			nodeIndex = secondChild;
+		}
+		u = std::min(u, .99999994f);
+	}
+
+	lightIndex = m_Nodes[nodeIndex].lightIndex;
+	return true;
+}
+
+float LightTree::GetImportance(const Node& node, const Vector3& position, const Vector3& normal)
+{
+	//Largest distance of a box corner in front of the surface, at or below zero none of the lights can reach the point
+	const Vector3 centre{ (node.minAABB + node.maxAABB) * .5f };
+	const Vector3 halfExtent{ (node.maxAABB - node.minAABB) * .5f };
+	const Vector3 toCentre{ centre - position };
+	const float maxHeight{ Vector3::Dot(normal, toCentre) +
+		fabsf(normal.x) * halfExtent.x + fabsf(normal.y) * halfExtent.y + fabsf(normal.z) * halfExtent.z };
+	if (maxHeight <= 0.f)
+		return 0.f;
+
+	//Distance to the centre, but never closer than half the diagonal, so a nearby cluster does not take all samples.
+	//For a single point light the cosine is exact, for a box it is an estimate.
+	constexpr float minSqrDistance{ 1e-4f };
+	const float sqrDistance{ std::max(std::max(toCentre.SqrMagnitude(), halfExtent.SqrMagnitude()), minSqrDistance) };
+	const float cosine{ std::min(maxHeight / sqrtf(sqrDistance), 1.f) };
+	return node.power * cosine / sqrDistance;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "Math.h"
+
+namespace dae
+{
+	struct Light;
+
+	//Bounding volume hierarchy over the point lights, to pick a light per shading point with a probability
+	//proportional to an estimate of its contribution: power over squared distance, zero for boxes behind the surface.
+	//Area lights are bounded by their extent. Directional lights have no position, they are listed separately and always evaluated.
+	class LightTree final
+	{
+	public:
+		LightTree() = default;
+		~LightTree() = default;
+
+		LightTree(const LightTree&) = delete;
+		LightTree(LightTree&&) noexcept = delete;
+		LightTree& operator=(const LightTree&) = delete;
+		LightTree& operator=(LightTree&&) noexcept = delete;
+
+		void Build(const std::vector<Light>& lights);
+
+		/**
+		 * \brief Walks down the tree, choosing each child by its importance for the shading point
+		 * \param u random number in [0, 1), rescaled at every level so one number is enough
+		 * \param lightIndex index into the lights the tree was built from
+		 * \param pdf probability of the chosen light, its contribution has to be divided by it
+		 * \return false when no light can reach the point
+		 */
+		bool Sample(const Vector3& position, const Vector3& normal, float u, uint32_t& lightIndex, float& pdf) const;
+
+		//Point and area lights
+		uint32_t GetPointLightCount() const { return m_NrPointLights; }
+		const std::vector<uint32_t>& GetDirectionalLights() const { return m_DirectionalLights; }
+
+	private:
+		//Depth first: the first child directly follows its parent
+		struct Node
+		{
+			Vector3 minAABB{};
+			Vector3 maxAABB{};
+			float power{};
+			//0 for leaves
+			uint32_t secondChild{};
+			uint32_t lightIndex{};
+		};
+
+		uint32_t BuildNode(const std::vector<Light>& lights, std::vector<uint32_t>::iterator first, std::vector<uint32_t>::iterator last);
+		static float GetImportance(const Node& node, const Vector3& position, const Vector3& normal);
+
+		std::vector<Node> m_Nodes{};
+		std::vector<uint32_t> m_DirectionalLights{};
+		uint32_t m_NrPointLights{};
+	};
+}
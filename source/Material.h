@@ -2,10 +2,20 @@
 #include "Math.h"
 #include "DataTypes.h"
 #include "BRDFs.h"
+#include "Utils.h"
 
 namespace dae
 {
 #pragma region Material BASE
+	//Perfectly specular reflection and transmission of a hit, traced as secondary rays by the renderer.
+	//The weights scale the light arriving from the mirrored and the transmitted direction.
+	struct SpecularScatter
+	{
+		ColorRGB reflectance{};
+		ColorRGB transmittance{};
+		Vector3 transmittedDirection{};
+	};
+
 	class Material
 	{
 	public:
@@ -25,6 +35,39 @@ namespace dae
 		 * \return color
 		 */
 		virtual ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) = 0;
+
+		//Surface color, the denoiser filters the lighting without it so material edges stay sharp
+		virtual ColorRGB GetAlbedo() const { return colors::White; }
+
+		//Shade does not depend on the view direction, the light reflected by the surface can be reused from any angle
+		virtual bool IsViewIndependent() const { return false; }
+
+		//Materials without specular parts are never asked for them
+		virtual bool HasSpecularScatter() const { return false; }
+		/**
+		 * \brief Weights of the mirrored and the transmitted ray, for a ray hitting the surface from either side
+		 * \param hitRecord current hitrecord
+		 * \param rayDirection direction of the incoming ray
+		 * \return reflectance, transmittance and the refracted direction
+		 */
+		virtual SpecularScatter GetSpecularScatter(const HitRecord& hitRecord, const Vector3& rayDirection) const { return {}; }
+
+		/**
+		 * \brief Picks the next direction of a path by importance of the material's scattering, specular parts included
+		 * \param hitRecord current hitrecord
+		 * \param rayDirection direction of the incoming ray
+		 * \param u1 u2 random numbers in [0, 1) for the direction
+		 * \param u3 random number in [0, 1) choosing between the lobes
+		 * \param l sampled direction
+		 * \return BRDF * cosine / pdf of the direction, black ends the path
+		 */
+		virtual ColorRGB SampleScatter(const HitRecord& hitRecord, const Vector3& rayDirection, float u1, float u2, float u3, Vector3& l)
+		{
+			// cosine weighted, exact for lambert: the cosine and PI cancel against the pdf
+			l = SamplingUtils::SampleCosineHemisphere(hitRecord.normal, u1, u2);
+			const ColorRGB brdf{ Shade(hitRecord, l, -rayDirection) };
+			return brdf * PI;
+		}
 	};
 #pragma endregion
 
@@ -43,6 +86,16 @@ namespace dae
 			return m_Color;
 		}
 
+		ColorRGB GetAlbedo() const override
+		{
+			return m_Color;
+		}
+
+		bool IsViewIndependent() const override
+		{
+			return true;
+		}
+
 	private:
 		ColorRGB m_Color{colors::White};
 	};
@@ -62,6 +115,16 @@ namespace dae
 			return BRDF::Lambert(m_DiffuseReflectance, m_DiffuseColor);
 		}
 
+		ColorRGB GetAlbedo() const override
+		{
+			return m_DiffuseColor * m_DiffuseReflectance;
+		}
+
+		bool IsViewIndependent() const override
+		{
+			return true;
+		}
+
 	private:
 		ColorRGB m_DiffuseColor{colors::White};
 		float m_DiffuseReflectance{1.f}; //kd
@@ -86,6 +149,11 @@ namespace dae
 				   BRDF::Phong(m_SpecularReflectance, m_PhongExponent, l, -v, hitRecord.normal) };
 		}
 
+		ColorRGB GetAlbedo() const override
+		{
+			return m_DiffuseColor * m_DiffuseReflectance;
+		}
+
 	private:
 		ColorRGB m_DiffuseColor{colors::White};
 		float m_DiffuseReflectance{0.5f}; //kd
@@ -99,8 +167,8 @@ namespace dae
 	class Material_CookTorrence final : public Material
 	{
 	public:
-		Material_CookTorrence(const ColorRGB& albedo, float metalness, float roughness/*, int reflectionValue*/):
-			m_Albedo(albedo), m_Metalness(metalness), m_Roughness(roughness)/*, m_ReflectionValue(reflectionValue)*/
+		Material_CookTorrence(const ColorRGB& albedo, float metalness, float roughness, float reflectivity = 0.f):
+			m_Albedo(albedo), m_Metalness(metalness), m_Roughness(roughness), m_Reflectivity(reflectivity)
 		{
 		}
 
@@ -135,17 +203,152 @@ namespace dae
 			return {diffuse + specular};
 		}
 
-		//virtual const int GetReflectionValue() const
-		//{
-		//	return m_ReflectionValue;
-		//}
+		ColorRGB GetAlbedo() const override
+		{
+			return m_Albedo;
+		}
+
+		bool HasSpecularScatter() const override
+		{
+			return m_Reflectivity > 0.f;
+		}
+
+		SpecularScatter GetSpecularScatter(const HitRecord& hitRecord, const Vector3& rayDirection) const override
+		{
+			// mirror reflection, fresnel at the normal instead of the half vector
+			const ColorRGB f0 = (AreEqual(m_Metalness, 0)) ? ColorRGB{ .04f, .04f, .04f } : m_Albedo;
+			const ColorRGB F{ BRDF::FresnelFunction_Schlick(hitRecord.normal, -rayDirection, f0) };
+			return { F * m_Reflectivity };
+		}
+
+		ColorRGB SampleScatter(const HitRecord& hitRecord, const Vector3& rayDirection, float u1, float u2, float u3, Vector3& l) override
+		{
+			const Vector3& n{ hitRecord.normal };
+			const Vector3 v{ -rayDirection };
+
+			// mirror reflection first, chosen by its share of the light
+			float mirrorProbability{ 0.f };
+			if (m_Reflectivity > 0.f)
+			{
+				const ColorRGB reflectance{ GetSpecularScatter(hitRecord, rayDirection).reflectance };
+				mirrorProbability = std::min((reflectance.r + reflectance.g + reflectance.b) / 3.f, 1.f);
+				if (u3 < mirrorProbability)
+				{
+					l = Vector3::Reflect(rayDirection, n);
+					return reflectance * (1.f / mirrorProbability);
+				}
+				u3 = (u3 - mirrorProbability) / (1.f - mirrorProbability);
+			}
+
+			// metals have no diffuse part, the others pick the diffuse and the specular lobe evenly
+			const float alpha{ m_Roughness * m_Roughness };
+			const float specularProbability{ (AreEqual(m_Metalness, 0)) ? .5f : 1.f };
+			if (u3 < specularProbability)
+			{
+				// GGX distributed half vector, the view direction mirrored around it
+				const float cosTheta{ sqrtf((1.f - u1) / (1.f + (Square(alpha) - 1.f) * u1)) };
+				const float sinTheta{ sqrtf(std::max(1.f - cosTheta * cosTheta, 0.f)) };
+				const float phi{ 2.f * PI * u2 };
+				Vector3 tangent{}, bitangent{};
+				SamplingUtils::GetTangentFrame(n, tangent, bitangent);
+				const Vector3 h{ tangent * (sinTheta * cosf(phi)) + bitangent * (sinTheta * sinf(phi)) + n * cosTheta };
+				l = Vector3::Reflect(rayDirection, h);
+			}
+			else
+			{
+				l = SamplingUtils::SampleCosineHemisphere(n, u1, u2);
+			}
+
+			const float cosLight{ Vector3::Dot(n, l) };
+			if (cosLight <= 0.f || Vector3::Dot(n, v) <= 0.f)
+				return {};
+
+			// pdf of both lobes together, a direction gets the same weight whichever lobe picked it
+			Vector3 h{ v + l };
+			h.Normalize();
+			const float specularPdf{ BRDF::NormalDistribution_GGX(n, h, alpha) * Vector3::Dot(n, h) / (4.f * Vector3::Dot(v, h)) };
+			const float pdf{ (specularProbability * specularPdf + (1.f - specularProbability) * cosLight / PI) * (1.f - mirrorProbability) };
+			if (pdf <= 0.f)
+				return {};
+
+			const ColorRGB brdf{ Shade(hitRecord, l, v) };
+			return brdf * (cosLight / pdf);
+		}
 
 	private:
-		//int m_ReflectionValue{ 1.f };
+		float m_Reflectivity{ 0.f }; // [0.0 > 1.0] share of the mirror reflection, traced as a secondary ray
 
 		ColorRGB m_Albedo{0.955f, 0.637f, 0.538f}; //Copper
 		float m_Metalness{1.0f};
 		float m_Roughness{0.1f}; // [1.0 > 0.0] >> [ROUGH > SMOOTH]
 	};
 #pragma endregion
+
+#pragma region Material DIELECTRIC
+	//DIELECTRIC
+	//==========
+	//Glass and other clear materials (Tf and Ni in .mtl files): all light is reflected or refracted, the direct lighting is black
+	class Material_Dielectric final : public Material
+	{
+	public:
+		Material_Dielectric(const ColorRGB& transmittance, float indexOfRefraction) :
+			m_Transmittance(transmittance), m_IndexOfRefraction(indexOfRefraction)
+		{
+		}
+
+		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
+		{
+			return {};
+		}
+
+		ColorRGB GetAlbedo() const override
+		{
+			return m_Transmittance;
+		}
+
+		bool HasSpecularScatter() const override
+		{
+			return true;
+		}
+
+		SpecularScatter GetSpecularScatter(const HitRecord& hitRecord, const Vector3& rayDirection) const override
+		{
+			// normals point out of the object, rays leaving it see the inverse ratio
+			float cosIncident{ -Vector3::Dot(rayDirection, hitRecord.normal) };
+			const bool isEntering{ cosIncident > 0.f };
+			const Vector3 normal{ isEntering ? hitRecord.normal : -hitRecord.normal };
+			cosIncident = fabsf(cosIncident);
+			const float eta{ isEntering ? 1.f / m_IndexOfRefraction : m_IndexOfRefraction };
+
+			// total internal reflection
+			const float sinTransmittedSquared{ eta * eta * (1.f - cosIncident * cosIncident) };
+			if (sinTransmittedSquared >= 1.f)
+				return { colors::White };
+
+			// schlick with the angle on the less dense side
+			const float cosTransmitted{ sqrtf(1.f - sinTransmittedSquared) };
+			const float f0{ Square((1.f - m_IndexOfRefraction) / (1.f + m_IndexOfRefraction)) };
+			const float F{ f0 + (1.f - f0) * powf(1.f - (isEntering ? cosIncident : cosTransmitted), 5.f) };
+
+			return { ColorRGB{ F, F, F }, m_Transmittance * (1.f - F), rayDirection * eta + normal * (eta * cosIncident - cosTransmitted) };
+		}
+
+		ColorRGB SampleScatter(const HitRecord& hitRecord, const Vector3& rayDirection, float u1, float u2, float u3, Vector3& l) override
+		{
+			// reflected with the fresnel probability, so neither ray needs extra weight
+			const SpecularScatter scatter{ GetSpecularScatter(hitRecord, rayDirection) };
+			if (u3 < scatter.reflectance.r)
+			{
+				l = Vector3::Reflect(rayDirection, hitRecord.normal);
+				return colors::White;
+			}
+			l = scatter.transmittedDirection;
+			return m_Transmittance;
+		}
+
+	private:
+		ColorRGB m_Transmittance{colors::White}; //Tf
+		float m_IndexOfRefraction{1.5f}; //Ni
+	};
+#pragma endregion
 }
@@ -0,0 +1,174 @@
+#include "RadianceCache.h"
+#include <algorithm>
+#include "DataTypes.h"
+#include "Utils.h"
+
+using namespace dae;
+
+namespace
+{
+	//Murmur3 finalizer, folded over the key
+	uint32_t HashCombine(uint32_t seed, uint32_t value)
+	{
+		uint32_t hash{ seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2)) };
+		hash ^= hash >> 16;
+		hash *= 0x85ebca6bu;
+		hash ^= hash >> 13;
+		hash *= 0xc2b2ae35u;
+		hash ^= hash >> 16;
+		return hash;
+	}
+
+	//Segment from start to end, slab test with t in [0, 1]
+	bool DoesSegmentHitBox(const Vector3& start, const Vector3& end, const Vector3& minAABB, const Vector3& maxAABB)
+	{
+		//Most segments are nowhere near the box, their bounds are enough to tell
+		const Vector3 minSegment{ Vector3::Min(start, end) }, maxSegment{ Vector3::Max(start, end) };
+		if (maxSegment.x < minAABB.x || maxSegment.y < minAABB.y || maxSegment.z < minAABB.z ||
+			minSegment.x > maxAABB.x || minSegment.y > maxAABB.y || minSegment.z > maxAABB.z)
+			return false;
+
+		const Vector3 direction{ end - start };
+		float tmin{ 0.f }, tmax{ 1.f };
+		for (int axis{}; axis < 3; ++axis)
+		{
+			//Parallel to the slab: inside it along the whole segment or never
+			if (direction[axis] == 0.f)
+			{
+				if (start[axis] < minAABB[axis] || start[axis] > maxAABB[axis])
+					return false;
+				continue;
+			}
+
+			const float t1{ (minAABB[axis] - start[axis]) / direction[axis] };
+			const float t2{ (maxAABB[axis] - start[axis]) / direction[axis] };
+			tmin = std::max(tmin, std::min(t1, t2));
+			tmax = std::min(tmax, std::max(t1, t2));
+		}
+		return tmax >= tmin;
+	}
+}
+
+RadianceCache::RadianceCache()
+{
+	m_Entries.resize(size_t(GROUP_COUNT) * GROUP_SIZE);
+}
+
+RadianceCache::Key RadianceCache::GetKey(const Vector3& position, const Vector3& normal, uint8_t materialIndex, float cellSize)
+{
+	//Rounded up to a power of two, so points at slightly different distances still share their cells
+	const int level{ std::clamp(int(ceilf(log2f(std::max(cellSize, FLT_MIN)))), MIN_LEVEL, MAX_LEVEL) };
+	const float scale{ ldexpf(1.f, -level) };
+	auto quantize = [](float component) { return uint32_t(std::clamp(int((component + 1.f) * (NORMAL_BINS / 2)), 0, NORMAL_BINS - 1)); };
+
+	return { int32_t(floorf(position.x * scale)), int32_t(floorf(position.y * scale)), int32_t(floorf(position.z * scale)),
+		uint32_t(level - MIN_LEVEL) | quantize(normal.x) << 8 | quantize(normal.y) << 11 | quantize(normal.z) << 14 | uint32_t(materialIndex) << 17 };
+}
+
+bool RadianceCache::Find(const Key& key, ColorRGB& radiance)
+{
+	const uint32_t group{ GetGroup(key) };
+	std::lock_guard lock{ m_Locks[group % LOCK_COUNT] };
+	for (uint32_t slot{ group * GROUP_SIZE }; slot < (group + 1) * GROUP_SIZE; ++slot)
+	{
+		Entry& entry{ m_Entries[slot] };
+		if (entry.nrSamples == 0 || !(entry.key == key))
+			continue;
+
+		entry.lastUsed = m_Frame;
+		if (entry.nrSamples < MIN_SAMPLES)
+			return false;
+
+		const ColorRGB& sum{ entry.sum };
+		radiance = sum * (1.f / entry.nrSamples);
+		return true;
+	}
+	return false;
+}
+
+void RadianceCache::AddSample(const Key& key, const ColorRGB& radiance)
+{
+	const uint32_t group{ GetGroup(key) };
+	std::lock_guard lock{ m_Locks[group % LOCK_COUNT] };
+
+	//An empty slot, otherwise the one unused for the most frames
+	Entry* pVictim{ nullptr };
+	for (uint32_t slot{ group * GROUP_SIZE }; slot < (group + 1) * GROUP_SIZE; ++slot)
+	{
+		Entry& entry{ m_Entries[slot] };
+		if (entry.nrSamples > 0 && entry.key == key)
+		{
+			entry.sum += radiance;
+			++entry.nrSamples;
+			entry.lastUsed = m_Frame;
+			return;
+		}
+
+		if (!pVictim || (pVictim->nrSamples > 0 && (entry.nrSamples == 0 || m_Frame - entry.lastUsed > m_Frame - pVictim->lastUsed)))
+			pVictim = &entry;
+	}
+
+	if (pVictim->nrSamples == 0)
+		++m_NrEntries;
+	*pVictim = { key, radiance, 1, m_Frame };
+}
+
+void RadianceCache::Clear()
+{
+	if (m_NrEntries == 0)
+		return;
+
+	std::fill(m_Entries.begin(), m_Entries.end(), Entry{});
+	m_NrEntries = 0;
+}
+
+uint32_t RadianceCache::Evict(const Vector3& minAABB, const Vector3& maxAABB, const std::vector<Light>& lights, float occlusionRadius, bool isShadowTested)
+{
+	//Far enough to leave the scene along a directional light
+	constexpr float shadowDistance{ 1000.f };
+
+	uint32_t nrEvicted{};
+	for (Entry& entry : m_Entries)
+	{
+		if (entry.nrSamples == 0)
+			continue;
+
+		//Lookups are jittered by up to a cell, the samples of an entry come from around it
+		const float cellSize{ GetCellSize(entry.key) };
+		const Vector3 centre{ (entry.key.x + .5f) * cellSize, (entry.key.y + .5f) * cellSize, (entry.key.z + .5f) * cellSize };
+		const Vector3 margin{ cellSize * 1.5f, cellSize * 1.5f, cellSize * 1.5f };
+
+		//Geometry within reach of the cell's occlusion rays, or in the way of any of its shadow rays. Area lights grow the box by their extent.
+		const Vector3 occlusionMargin{ margin + Vector3{ occlusionRadius, occlusionRadius, occlusionRadius } };
+		const Vector3 minCell{ Vector3::Max(centre - occlusionMargin, minAABB) }, maxCell{ Vector3::Min(centre + occlusionMargin, maxAABB) };
+		bool isAffected{ minCell.x <= maxCell.x && minCell.y <= maxCell.y && minCell.z <= maxCell.z };
+		for (size_t lightIndex{}; !isAffected && isShadowTested && lightIndex < lights.size(); ++lightIndex)
+		{
+			const Light& light{ lights[lightIndex] };
+			const float extent{ LightUtils::GetExtent(light) };
+			const Vector3 lightMargin{ margin + Vector3{ extent, extent, extent } };
+			const Vector3 end{ light.type == LightType::Directional ? centre + light.direction * shadowDistance : light.origin };
+			isAffected = DoesSegmentHitBox(centre, end, minAABB - lightMargin, maxAABB + lightMargin);
+		}
+
+		if (isAffected)
+		{
+			entry = {};
+			++nrEvicted;
+		}
+	}
+
+	m_NrEntries -= nrEvicted;
+	return nrEvicted;
+}
+
+uint32_t RadianceCache::GetGroup(const Key& key)
+{
+	const uint32_t hash{ HashCombine(HashCombine(HashCombine(HashCombine(0, uint32_t(key.x)), uint32_t(key.y)), uint32_t(key.z)), key.bits) };
+	return hash & (GROUP_COUNT - 1);
+}
+
+float RadianceCache::GetCellSize(const Key& key)
+{
+	return ldexpf(1.f, int(key.bits & 0xFF) + MIN_LEVEL);
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "Math.h"
+
+namespace dae
+{
+	struct Light;
+
+	//Spatial hash of the direct light on view independent surfaces, keyed on a world-space cell, the normal and the material.
+	//Cell sizes are powers of two picked from the size asked for, so cells cover about the same number of pixels at any distance.
+	//Lookups and samples can come from several threads at once, every group of slots has its own lock.
+	class RadianceCache final
+	{
+	public:
+		struct Key
+		{
+			int32_t x{};
+			int32_t y{};
+			int32_t z{};
+			//Level of the cell size, quantized normal and material index
+			uint32_t bits{};
+
+			bool operator==(const Key& other) const = default;
+		};
+
+		RadianceCache();
+		~RadianceCache() = default;
+
+		RadianceCache(const RadianceCache&) = delete;
+		RadianceCache(RadianceCache&&) noexcept = delete;
+		RadianceCache& operator=(const RadianceCache&) = delete;
+		RadianceCache& operator=(RadianceCache&&) noexcept = delete;
+
+		static Key GetKey(const Vector3& position, const Vector3& normal, uint8_t materialIndex, float cellSize);
+
+		//False when the cell is unknown or still collecting samples, the light has to be computed and added then
+		bool Find(const Key& key, ColorRGB& radiance);
+		//Creates the entry when needed, replacing the least recently used one of a full group
+		void AddSample(const Key& key, const ColorRGB& radiance);
+
+		//Entries used from now on count as used in this frame
+		void NextFrame() { ++m_Frame; }
+		void Clear();
+		/**
+		 * \brief Removes the entries whose light may change with geometry moving in or out of a box
+		 * \param lights the shadow rays of every light are tested against the box, unless shadows are off
+		 * \param occlusionRadius reach of the occlusion rays in the cached light, 0 when there are none
+		 * \return number of removed entries
+		 */
+		uint32_t Evict(const Vector3& minAABB, const Vector3& maxAABB, const std::vector<Light>& lights, float occlusionRadius, bool isShadowTested);
+
+		uint32_t GetEntryCount() const { return m_NrEntries; }
+		uint32_t GetCapacity() const { return uint32_t(m_Entries.size()); }
+		//Bytes allocated for the slots, used or not
+		size_t GetMemorySize() const { return m_Entries.size() * sizeof(Entry); }
+
+	private:
+		static constexpr uint32_t GROUP_COUNT{ 1 << 14 };
+		static constexpr uint32_t GROUP_SIZE{ 8 };
+		static constexpr uint32_t LOCK_COUNT{ 64 };
+		//Samples averaged before an entry is reused, so sampled lights and occlusion are not frozen as a single noisy value
+		static constexpr uint32_t MIN_SAMPLES{ 4 };
+		//Cell sizes from 2^MIN_LEVEL to 2^MAX_LEVEL, and the number of bins per normal component
+		static constexpr int MIN_LEVEL{ -12 };
+		static constexpr int MAX_LEVEL{ 15 };
+		static constexpr int NORMAL_BINS{ 8 };
+
+		//Empty without samples
+		struct Entry
+		{
+			Key key{};
+			ColorRGB sum{};
+			uint32_t nrSamples{};
+			uint32_t lastUsed{};
+		};
+
+		static uint32_t GetGroup(const Key& key);
+		static float GetCellSize(const Key& key);
+
+		std::vector<Entry> m_Entries{};
+		std::array<std::mutex, LOCK_COUNT> m_Locks{};
+		std::atomic<uint32_t> m_NrEntries{};
+		uint32_t m_Frame{};
+	};
+}
@@ -0,0 +1,217 @@
+#include "RenderThread.h"
+
+//External includes
+#include "SDL.h"
+
+//Project includes
+#include "Renderer.h"
+#include "Scene.h"
+#include "Timer.h"
+
+using namespace dae;
+
+RenderThread::RenderThread(Renderer* pRenderer, Scene* pScene, Timer* pTimer) :
+	m_pRenderer(pRenderer),
+	m_pScene(pScene),
+	m_pTimer(pTimer)
+{
+	m_SecondsPerCount = 1.f / static_cast<float>(SDL_GetPerformanceFrequency());
+}
+
+RenderThread::~RenderThread()
+{
+	Stop();
+}
+
+void RenderThread::Start()
+{
+	if (m_IsRunning)
+		return;
+
+	m_IsRunning = true;
+	m_StatsStart = SDL_GetPerformanceCounter();
+	m_UpdateThread = std::thread(&RenderThread::RunUpdates, this);
+	m_Thread = std::thread(&RenderThread::Run, this);
+}
+
+void RenderThread::Stop()
+{
+	m_IsRunning = false;
+	m_InputCondition.notify_all();
+	if (m_Thread.joinable())
+		m_Thread.join();
+
+	{
+		std::lock_guard lock{ m_UpdateMutex };
+		m_UpdateCondition.notify_all();
+	}
+	if (m_UpdateThread.joinable())
+		m_UpdateThread.join();
+}
+
+void RenderThread::SubmitInput(const CameraInput& input)
+{
+	{
+		std::lock_guard lock{ m_InputMutex };
+		m_PendingInput.Accumulate(input);
+	}
+
+	//Wake an idle render thread as soon as the camera has to move
+	if (input.IsActive())
+		m_InputCondition.notify_one();
+}
+
+bool RenderThread::Present(uint32_t timeoutMs)
+{
+	uint64_t inputTimestamp{};
+	const bool presented{ m_pRenderer->Present(timeoutMs, inputTimestamp) };
+
+	const uint64_t currentTime{ SDL_GetPerformanceCounter() };
+	if (presented)
+	{
+		m_LatencyCounts += currentTime - inputTimestamp;
+		++m_PresentedFrames;
+	}
+
+	//Average over roughly one second, same window as the Timer FPS
+	const float statsTime{ (currentTime - m_StatsStart) * m_SecondsPerCount };
+	if (statsTime >= 1.f)
+	{
+		m_RenderFPS = m_RenderedFrames.exchange(0) / statsTime;
+		m_PresentFPS = m_PresentedFrames / statsTime;
+		if (m_PresentedFrames > 0)
+			m_AverageLatency = m_LatencyCounts * m_SecondsPerCount / m_PresentedFrames;
+
+		m_StatsStart = currentTime;
+		m_LatencyCounts = 0;
+		m_PresentedFrames = 0;
+	}
+
+	return presented;
+}
+
+CameraInput RenderThread::ConsumeInput(uint64_t& timestamp)
+{
+	//Pick up the latest input as late as possible, right before the frame starts
+	std::lock_guard lock{ m_InputMutex };
+	timestamp = SDL_GetPerformanceCounter();
+
+	const CameraInput input{ m_PendingInput };
+	m_PendingInput.mouseX = 0;
+	m_PendingInput.mouseY = 0;
+	return input;
+}
+
+void RenderThread::WaitForInput(uint32_t timeoutMs)
+{
+	std::unique_lock lock{ m_InputMutex };
+	m_InputCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return m_PendingInput.IsActive() || !m_IsRunning; });
+}
+
+void RenderThread::StartUpdate(SceneSnapshot* pSnapshot)
+{
+	{
+		std::lock_guard lock{ m_UpdateMutex };
+		m_pUpdateTarget = pSnapshot;
+	}
+	m_UpdateCondition.notify_all();
+}
+
+void RenderThread::WaitForUpdate()
+{
+	std::unique_lock lock{ m_UpdateMutex };
+	m_UpdateCondition.wait(lock, [this] { return m_pUpdateTarget == nullptr; });
+}
+
+void RenderThread::RunUpdates()
+{
+	while (true)
+	{
+		SceneSnapshot* pSnapshot{};
+		{
+			std::unique_lock lock{ m_UpdateMutex };
+			m_UpdateCondition.wait(lock, [this] { return m_pUpdateTarget != nullptr || !m_IsRunning; });
+			if (!m_pUpdateTarget)
+				return;
+			pSnapshot = m_pUpdateTarget;
+		}
+
+		//Animation + transforms of the next frame, written into the snapshot that is not being rendered
+		m_pScene->Update(m_pTimer);
+		m_pScene->CaptureSnapshot(*pSnapshot);
+
+		{
+			std::lock_guard lock{ m_UpdateMutex };
+			m_pUpdateTarget = nullptr;
+		}
+		m_UpdateCondition.notify_all();
+	}
+}
+
+void RenderThread::UpdateRenderScale(bool hasRendered)
+{
+	if (!m_DynamicResolutionEnabled)
+	{
+		if (m_DynamicResolution.GetScale() < 1.f)
+		{
+			m_DynamicResolution.Reset();
+			m_pRenderer->SetRenderScale(1.f);
+		}
+		return;
+	}
+
+	//Idle frames include the wait for input, only frames that traced something say anything about the cost
+	if (hasRendered)
+		m_pRenderer->SetRenderScale(m_DynamicResolution.Update(m_pTimer->GetElapsed()));
+}
+
+void RenderThread::Run()
+{
+	//First frame has nothing to overlap with
+	int currentSnapshot{ 0 };
+	m_pScene->Update(m_pTimer);
+	m_pScene->CaptureSnapshot(m_Snapshots[currentSnapshot]);
+
+	while (m_IsRunning)
+	{
+		if (m_BenchmarkRequested.exchange(false))
+			m_pTimer->StartBenchmark();
+
+		SceneSnapshot& snapshot{ m_Snapshots[currentSnapshot] };
+		const int nextSnapshot{ (currentSnapshot + 1) % SNAPSHOT_COUNT };
+
+		//--------- Camera ---------
+		//Cheap, so it stays out of the pipeline and uses the latest input
+		uint64_t inputTimestamp{};
+		m_pScene->GetCamera().input = ConsumeInput(inputTimestamp);
+		m_pScene->UpdateCamera(m_pTimer);
+		m_pScene->CaptureCamera(snapshot);
+
+		//Blocks the render thread until it is done, the window keeps presenting the last frame
+		if (m_ConvergenceBenchmarkRequested.exchange(false))
+			m_pRenderer->RunConvergenceBenchmark(snapshot);
+		if (m_ScalingBenchmarkRequested.exchange(false))
+			m_pRenderer->RunScalingBenchmark(snapshot);
+
+		//--------- Update (next frame) ---------
+		StartUpdate(&m_Snapshots[nextSnapshot]);
+
+		//--------- Render ---------
+		const bool hasRendered{ m_pRenderer->Render(snapshot, inputTimestamp) };
+		WaitForUpdate();
+
+		//Nothing changed and nothing left to refine: sleep until input arrives or the idle interval passes,
+		//the cheap update keeps running so animations and edits are still picked up
+		m_IsIdle = !hasRendered;
+		if (hasRendered)
+			++m_RenderedFrames;
+		else
+			WaitForInput(IDLE_INTERVAL_MS);
+
+		//--------- Timer ---------
+		m_pTimer->Update();
+		UpdateRenderScale(hasRendered);
+
+		currentSnapshot = nextSnapshot;
+	}
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+//Standard includes
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+//Project includes
+#include "Camera.h"
+#include "DynamicResolution.h"
+#include "Scene.h"
+
+namespace dae
+{
+	class Renderer;
+	class Timer;
+
+	//Runs Scene::Update + Renderer::Render on a dedicated thread so the main thread stays free for input and presenting.
+	//The update of frame N+1 runs on a worker thread while frame N renders from its own snapshot.
+	class RenderThread final
+	{
+	public:
+		RenderThread(Renderer* pRenderer, Scene* pScene, Timer* pTimer);
+		~RenderThread();
+
+		RenderThread(const RenderThread&) = delete;
+		RenderThread(RenderThread&&) noexcept = delete;
+		RenderThread& operator=(const RenderThread&) = delete;
+		RenderThread& operator=(RenderThread&&) noexcept = delete;
+
+		void Start();
+		void Stop();
+
+		//Main thread
+		void SubmitInput(const CameraInput& input);
+		bool Present(uint32_t timeoutMs);
+		void RequestBenchmark() { m_BenchmarkRequested = true; }
+		void RequestConvergenceBenchmark() { m_ConvergenceBenchmarkRequested = true; }
+		void RequestScalingBenchmark() { m_ScalingBenchmarkRequested = true; }
+		void ToggleDynamicResolution() { m_DynamicResolutionEnabled = !m_DynamicResolutionEnabled; }
+
+		//Configure before Start, the controller is owned by the render thread afterwards
+		DynamicResolution& GetDynamicResolution() { return m_DynamicResolution; }
+		bool IsDynamicResolutionEnabled() const { return m_DynamicResolutionEnabled; }
+
+		//Throughput: frames finished by the render thread, latency: input sample until the frame is on screen
+		float GetRenderFPS() const { return m_RenderFPS; }
+		bool IsIdle() const { return m_IsIdle; }
+		float GetPresentFPS() const { return m_PresentFPS; }
+		float GetAverageLatency() const { return m_AverageLatency; }
+
+	private:
+		void Run();
+		void RunUpdates();
+		CameraInput ConsumeInput(uint64_t& timestamp);
+		void WaitForInput(uint32_t timeoutMs);
+
+		void StartUpdate(SceneSnapshot* pSnapshot);
+		void WaitForUpdate();
+		void UpdateRenderScale(bool hasRendered);
+
+		static constexpr int SNAPSHOT_COUNT{ 2 };
+		static constexpr uint32_t IDLE_INTERVAL_MS{ 16 };
+
+		Renderer* m_pRenderer{};
+		Scene* m_pScene{};
+		Timer* m_pTimer{};
+
+		std::thread m_Thread{};
+		std::thread m_UpdateThread{};
+		std::atomic<bool> m_IsRunning{ false };
+		std::atomic<bool> m_BenchmarkRequested{ false };
+		std::atomic<bool> m_ConvergenceBenchmarkRequested{ false };
+		std::atomic<bool> m_ScalingBenchmarkRequested{ false };
+		std::atomic<uint32_t> m_RenderedFrames{};
+		std::atomic<bool> m_IsIdle{ false };
+
+		DynamicResolution m_DynamicResolution{};
+		std::atomic<bool> m_DynamicResolutionEnabled{ false };
+
+		std::mutex m_InputMutex{};
+		std::condition_variable m_InputCondition{};
+		CameraInput m_PendingInput{};
+
+		//Recycled every other frame: one is being rendered, the other one is being filled by the update
+		SceneSnapshot m_Snapshots[SNAPSHOT_COUNT]{};
+
+		std::mutex m_UpdateMutex{};
+		std::condition_variable m_UpdateCondition{};
+		SceneSnapshot* m_pUpdateTarget{};
+
+		//Latency stats, only touched by the main thread
+		float m_SecondsPerCount{};
+		uint64_t m_StatsStart{};
+		uint64_t m_LatencyCounts{};
+		uint32_t m_PresentedFrames{};
+		float m_RenderFPS{};
+		float m_PresentFPS{};
+		float m_AverageLatency{};
+	};
+}
@@ -1,135 +1,2488 @@
 //External includes
 #include "SDL.h"
 #include "SDL_surface.h"
+#include <algorithm>
+#include <cstring>
 #include <execution>
+#include <fstream>
+#include <iostream>
+#include <numeric>
 
 //Project includes
 #include "Renderer.h"
+#include "CpuTopology.h"
 #include "Math.h"
 #include "Material.h"
 #include "Scene.h"
 #include "Utils.h"
+#include "WorkerPool.h"
 
 #define PARALLEL_EXECUTION
 
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_OUTPUT
+#endif
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 using namespace dae;
 
+ShadingRate ShadingRateMap::GetRate(float u, float v) const
+{
+	if (rates.empty())
+		return ShadingRate::Rate1x1;
+
+	const int x{ std::clamp(int(u * width), 0, width - 1) };
+	const int y{ std::clamp(int(v * height), 0, height - 1) };
+	return rates[x + y * width];
+}
+
+ShadingRateMap ShadingRateMap::CreateFoveated(int width, int height, float focusX, float focusY, float innerRadius, float outerRadius)
+{
+	ShadingRateMap rateMap{ width, height };
+	rateMap.rates.resize(size_t(width) * height);
+
+	for (int y{}; y < height; ++y)
+	{
+		for (int x{}; x < width; ++x)
+		{
+			//Cells are square, so distances are measured in cells and scaled by the height
+			const float distanceX{ x + .5f - focusX * width }, distanceY{ y + .5f - focusY * height };
+			const float distance{ sqrtf(distanceX * distanceX + distanceY * distanceY) / height };
+
+			ShadingRate& rate{ rateMap.rates[x + y * width] };
+			if (distance <= innerRadius) rate = ShadingRate::Rate1x1;
+			else if (distance <= outerRadius) rate = ShadingRate::Rate2x2;
+			else rate = ShadingRate::Rate4x4;
+		}
+	}
+
+	return rateMap;
+}
+
 Renderer::Renderer(SDL_Window * pWindow) :
 	m_pWindow(pWindow),
 	m_pBuffer(SDL_GetWindowSurface(pWindow))
 {
 	//Initialize
-	SDL_GetWindowSize(pWindow, &m_Width, &m_Height);
-	m_pBufferPixels = static_cast<uint32_t*>(m_pBuffer->pixels);
+	SDL_GetWindowSize(pWindow, &m_WindowWidth, &m_WindowHeight);
+	m_Width = m_WindowWidth;
+	m_Height = m_WindowHeight;
+	m_pShadeLightSample = GetShadeLightSampleKernel(m_CurrentLightingMode, m_ShadowsEnabled);
+
+	//Everything is sized for the full window resolution, a lower render scale only uses part of it
+	for (auto& frameBuffer : m_FrameBuffers)
+	{
+		frameBuffer.resize(size_t(m_WindowWidth) * m_WindowHeight);
+	}
+	m_ColorBuffer.resize(size_t(m_WindowWidth) * m_WindowHeight);
+	m_GBuffer.resize(size_t(m_WindowWidth) * m_WindowHeight);
+	m_EdgeMask.resize(size_t(m_WindowWidth) * m_WindowHeight);
+	m_AccumulationBuffer.resize(size_t(m_WindowWidth) * m_WindowHeight);
+
+	m_OutputRows.resize(m_WindowHeight);
+	std::iota(m_OutputRows.begin(), m_OutputRows.end(), 0);
+	m_UpscaleBuffer.resize(size_t(m_WindowWidth) * m_WindowHeight);
+
+	//32 bit pixels with full 8 bit color channels can be packed with shifts, which covers RGB888 and ARGB8888
+	const SDL_PixelFormat* pFormat{ m_pBuffer->format };
+	m_OutputFormat.isPacked = pFormat->BytesPerPixel == 4 && !pFormat->palette
+		&& pFormat->Rloss == 0 && pFormat->Gloss == 0 && pFormat->Bloss == 0;
+	m_OutputFormat.redShift = pFormat->Rshift;
+	m_OutputFormat.greenShift = pFormat->Gshift;
+	m_OutputFormat.blueShift = pFormat->Bshift;
+	m_OutputFormat.alphaMask = pFormat->Amask;
+
+	m_NrTilesX = (m_Width + TILE_SIZE - 1) / TILE_SIZE;
+	m_NrTilesY = (m_Height + TILE_SIZE - 1) / TILE_SIZE;
+	m_ActiveTiles.reserve(size_t(m_NrTilesX) * m_NrTilesY);
+	m_TileIndices.resize(size_t(m_NrTilesX) * m_NrTilesY);
+	std::iota(m_TileIndices.begin(), m_TileIndices.end(), 0);
+	m_DirtyTiles.resize(size_t(m_NrTilesX) * m_NrTilesY);
+	m_TileSampleCounts.resize(size_t(m_NrTilesX) * m_NrTilesY);
+	m_HalfTracedTiles.resize(size_t(m_NrTilesX) * m_NrTilesY);
+	m_PendingTiles.resize(size_t(m_NrTilesX) * m_NrTilesY);
+	m_TileRates.resize(size_t(m_NrTilesX) * m_NrTilesY, uint8_t(1));
+	m_RenderedTileRates.resize(size_t(m_NrTilesX) * m_NrTilesY, uint8_t(1));
+}
+
+void Renderer::ApplyRenderScale()
+{
+	const float scale{ m_RequestedScale };
+	const int width{ std::clamp(int(roundf(m_WindowWidth * scale)), 1, m_WindowWidth) };
+	const int height{ std::clamp(int(roundf(m_WindowHeight * scale)), 1, m_WindowHeight) };
+	if (width == m_Width && height == m_Height)
+		return;
+
+	m_Width = width;
+	m_Height = height;
+	m_NrTilesX = (m_Width + TILE_SIZE - 1) / TILE_SIZE;
+	m_NrTilesY = (m_Height + TILE_SIZE - 1) / TILE_SIZE;
+	m_DirtyTiles.resize(size_t(m_NrTilesX) * m_NrTilesY);
+	m_TileSampleCounts.resize(size_t(m_NrTilesX) * m_NrTilesY);
+	m_HalfTracedTiles.resize(size_t(m_NrTilesX) * m_NrTilesY);
+	m_PendingTiles.assign(size_t(m_NrTilesX) * m_NrTilesY, uint8_t(0));
+	m_TileRates.resize(size_t(m_NrTilesX) * m_NrTilesY, uint8_t(1));
+	m_RenderedTileRates.resize(size_t(m_NrTilesX) * m_NrTilesY, uint8_t(1));
+
+	//Nothing of the previous image can be reused
+	m_HasRendered = false;
+}
+
+bool Renderer::Render(const SceneSnapshot& scene, uint64_t inputTimestamp)
+{
+	const uint64_t frameStart{ SDL_GetPerformanceCounter() };
+	const float secondsPerCount{ 1.f / SDL_GetPerformanceFrequency() };
+
+	m_LightingModeFrame = m_CurrentLightingMode;
+	m_PathTraceFrame = m_LightingModeFrame == LightingMode::PathTraced;
+	m_pShadeLightSample = GetShadeLightSampleKernel(m_LightingModeFrame, m_ShadowsEnabled);
+	m_IsPathTracing = m_PathTraceFrame;
+	m_AccumulateFrame = m_AccumulationEnabled || m_PathTraceFrame;
+	m_CheckerboardFrame = m_CheckerboardEnabled;
+	m_CacheFrame = m_CacheEnabled && !m_PathTraceFrame;
+	m_RadianceCacheFrame = m_RadianceCacheEnabled && !m_PathTraceFrame;
+	m_AoFrame = m_AmbientOcclusionEnabled;
+	m_AoFrameSamples = m_AoSampleCount;
+	m_SpecularFrame = m_SpecularEnabled && !m_PathTraceFrame && std::any_of(scene.materials.begin(), scene.materials.end(), [](const Material* pMaterial) { return pMaterial->HasSpecularScatter(); });
+	m_IsTracingSpecular = m_SpecularFrame;
+	m_MaterialAlbedos.resize(scene.materials.size());
+	std::transform(scene.materials.begin(), scene.materials.end(), m_MaterialAlbedos.begin(), [](const Material* pMaterial) { return pMaterial->GetAlbedo(); });
+	m_Sampler.SetType(m_RequestedSampler);
+	ApplyRenderScale();
+	m_PixelFootprint = 2.f * tanf((scene.fovAngle * TO_RADIANS) / 2) / m_Height;
+	m_RadianceCache.NextFrame();
+
+	const bool wasBudgeted{ m_BudgetFrame };
+	m_BudgetFrame = m_BudgetEnabled;
+	if (m_BudgetFrame && !wasBudgeted)
+		m_BudgetedFrames = m_DeadlineHits = 0;
+	m_TraceDeadline = frameStart + uint64_t(m_FrameBudget * BUDGET_TRACE_FRACTION * SDL_GetPerformanceFrequency());
+
+	if (!m_NodeScenes.empty())
+		UpdateNodeScenes(scene);
+
+	//A moving camera starts over from the coarsest preview
+	if (!m_ProgressiveEnabled)
+		m_PreviewBlockSize = 1;
+	else if (m_HasRendered && scene.versions.camera != m_RenderedVersions.camera)
+		m_PreviewBlockSize = MAX_PREVIEW_BLOCK_SIZE;
+
+	m_FrameStats = {};
+	m_FrameRayCount = 0;
+	m_FrameLightCount = 0;
+	m_FrameShadowRayCount = 0;
+	m_FrameAoTicks = 0;
+	m_FrameAoRayCount = 0;
+	m_FrameTileTicks = 0;
+	m_FrameCacheHits = 0;
+	m_FrameRadianceLookups = 0;
+	m_FrameRadianceHits = 0;
+	for (std::atomic<uint64_t>& count : m_FrameSpecularRayCounts)
+		count = 0;
+	m_FramePathRayCount = 0;
+
+	//Every preview level is handed over as soon as it is done, the finer ones follow while they fit in the budget.
+	//Whatever does not fit is refined in the next frames, also when nothing changes anymore.
+	bool hasRendered{ false };
+	while (true)
+	{
+		UpdateTileRates();
+		if (!CollectTiles(scene))
+			break;
+
+		const uint64_t passStart{ SDL_GetPerformanceCounter() };
+		RenderPass(scene);
+		HandOverFrame(inputTimestamp);
+		hasRendered = true;
+
+		//Past the deadline, the finer passes have to wait for the next frame
+		if (m_PreviewBlockSize == 1 || m_FrameStats.nrSkippedTiles > 0)
+			break;
+
+		//Halving the block size quadruples the rays
+		m_PreviewBlockSize /= 2;
+		const uint64_t passEnd{ SDL_GetPerformanceCounter() };
+		const float nextPassEstimate{ (passEnd - passStart) * secondsPerCount * 4.f };
+		if ((passEnd - frameStart) * secondsPerCount + nextPassEstimate > m_FrameBudget)
+			break;
+	}
+
+	if (!hasRendered)
+	{
+		//Exposure or tone mapping changed, or the exposure is still adapting: only the output stage runs again
+		if (m_HasRendered && NeedsPostUpdate())
+		{
+			HandOverFrame(inputTimestamp);
+			m_PostTime = m_FrameStats.postTime;
+		}
+		return false;
+	}
+
+	if (m_BudgetFrame)
+	{
+		++m_BudgetedFrames;
+		if ((SDL_GetPerformanceCounter() - frameStart) * secondsPerCount <= m_FrameBudget)
+			++m_DeadlineHits;
+		m_DeadlineHitRate = m_DeadlineHits / float(m_BudgetedFrames);
+	}
+	m_TileCompletion = m_FrameStats.nrCompletedTiles / float(m_FrameStats.nrCompletedTiles + m_FrameStats.nrSkippedTiles);
+
+	m_TraceTime = m_FrameStats.traceTime;
+	m_PostTime = m_FrameStats.postTime;
+	m_ReconstructTime = m_FrameStats.reconstructTime;
+	m_TracedRayCount = m_FrameRayCount.load();
+	m_SamplesPerPixel = m_TracedRayCount / float(m_FrameStats.nrPixels);
+	m_CacheHitRate = m_FrameCacheHits / float(m_TracedRayCount);
+	m_RadianceCacheHitRate = m_FrameRadianceLookups > 0 ? m_FrameRadianceHits / float(m_FrameRadianceLookups) : 0.f;
+	m_LightsPerPixel = m_FrameLightCount / float(m_TracedRayCount);
+	m_ShadowRaysPerLight = m_FrameLightCount > 0 ? m_FrameShadowRayCount / float(m_FrameLightCount) : 0.f;
+	for (uint32_t depth{}; depth < MAX_SPECULAR_DEPTH; ++depth)
+		m_SpecularRayCounts[depth] = uint32_t(m_FrameSpecularRayCounts[depth].load());
+	if (m_PathTraceFrame)
+	{
+		m_PathSamplesPerSecond = m_TraceTime > 0.f ? m_TracedRayCount / m_TraceTime : 0.f;
+		m_PathRaysPerSample = m_FramePathRayCount / float(m_TracedRayCount);
+	}
+
+	if (m_AoFrame && m_FrameAoRayCount > 0 && m_FrameTileTicks > 0)
+	{
+		//The ticks are summed over the threads, their share of the tile work gives the share of the tracing time
+		m_AoTime = m_TraceTime * (m_FrameAoTicks / float(m_FrameTileTicks));
+
+		//Rays per hit that fit the budget in a full frame, at most doubling per frame so one slow frame does not overshoot
+		const float secondsPerRay{ m_AoTime / m_FrameAoRayCount };
+		const float budgetRays{ m_FrameBudget * AO_BUDGET_FRACTION / (secondsPerRay * m_Width * m_Height) };
+		m_AoSampleCount = std::clamp(uint32_t(budgetRays), 1u, std::min(m_AoFrameSamples * 2, AO_MAX_SAMPLES));
+	}
+	return true;
 }
 
-void Renderer::Render(Scene* pScene) const
+void Renderer::RenderPass(const SceneSnapshot& scene)
 {
-	Camera& camera = pScene->GetCamera();
-	const Matrix cameraToWorld{ camera.CalculateCameraToWorld() };
+	UpdateLights(scene);
+
+	const Matrix& cameraToWorld{ scene.cameraToWorld };
 
 	const float aspectRatio = m_Width / static_cast<float>(m_Height);
-	const float FOV = tanf((camera.fovAngle * TO_RADIANS) / 2);
+	const float FOV = tanf((scene.fovAngle * TO_RADIANS) / 2);
 
-	uint32_t amountOfPixels{ uint32_t(m_Width * m_Height) };
+	if (m_CheckerboardFrame)
+	{
+		//Alternate the traced pixels every frame, the previous image is what the gaps get reprojected from
+		m_CheckerboardParity ^= 1;
+		if (m_IsHistoryValid)
+		{
+			m_HistoryColorBuffer = m_ColorBuffer;
+			m_HistoryGBuffer = m_GBuffer;
+		}
+	}
 
-#if defined(PARALLEL_EXECUTION)
-	// parallel logic
-	std::vector<uint32_t> pixelIndices{};
-	pixelIndices.reserve(amountOfPixels);
-	for (uint32_t index{}; index < amountOfPixels; index++)
+	if (m_CacheFrame)
 	{
-		pixelIndices.emplace_back(index);
+		if (m_Cache.empty())
+		{
+			m_Cache.resize(m_ColorBuffer.size());
+			m_HistoryCache.resize(m_ColorBuffer.size());
+		}
+
+		//Every pixel gets rewritten when all tiles are rendered, otherwise the untouched tiles have to carry over
+		//A budgeted frame can skip some of them
+		if (m_ActiveTiles.size() == m_DirtyTiles.size() && !m_BudgetFrame) std::swap(m_Cache, m_HistoryCache);
+		else m_HistoryCache = m_Cache;
+		++m_CacheFrameIndex;
+	}
+
+	if (m_ResampleLightsFrame)
+	{
+		if (m_Reservoirs.empty())
+		{
+			m_Reservoirs.resize(m_ColorBuffer.size());
+			m_HistoryReservoirs.resize(m_ColorBuffer.size());
+		}
+
+		if (m_ActiveTiles.size() == m_DirtyTiles.size() && !m_BudgetFrame) std::swap(m_Reservoirs, m_HistoryReservoirs);
+		else m_HistoryReservoirs = m_Reservoirs;
+		//New candidates every pass, otherwise merging the history adds nothing
+		++m_ResampleFrameIndex;
+	}
+
+	const uint64_t traceStart{ SDL_GetPerformanceCounter() };
+
+	//Checked between tiles, whatever is left at the deadline stays pending
+	auto traceTile = [&](const SceneSnapshot& tileScene, uint32_t tileIndex)
+	{
+		const bool isPastDeadline{ m_BudgetFrame && SDL_GetPerformanceCounter() >= m_TraceDeadline };
+		m_PendingTiles[tileIndex] = uint8_t(isPastDeadline);
+		if (!isPastDeadline)
+			RenderTile(tileScene, tileIndex, FOV, aspectRatio, cameraToWorld, scene.cameraOrigin);
+	};
+
+	if (m_pWorkerPool)
+	{
+		//Node-local scene copy of the worker, tiles were queued on the node holding their rows
+		m_pWorkerPool->ForEach(uint32_t(m_ActiveTiles.size()),
+			[this](uint32_t index) { return GetTileNode(m_ActiveTiles[index]); },
+			[&](uint32_t index, int node) {
+				traceTile(m_NodeScenes.empty() ? scene : m_NodeScenes[node], m_ActiveTiles[index]);
+			});
+	}
+	else
+	{
+#if defined(PARALLEL_EXECUTION)
+		// parallel logic, the tiles are taken in list order so the pending ones are traced first
+		std::atomic<uint32_t> nextTile{};
+		std::for_each(std::execution::par, m_ActiveTiles.begin(), m_ActiveTiles.end(), [&](uint32_t) {
+			traceTile(scene, m_ActiveTiles[nextTile++]);
+			});
+#else
+		// synchronous
+		for (const uint32_t tileIndex : m_ActiveTiles)
+		{
+			traceTile(scene, tileIndex);
+		}
+#endif
 	}
 
-	std::for_each(std::execution::par, pixelIndices.begin(), pixelIndices.end(), [&](int i) {
-		RenderPixel(pScene, i, FOV, aspectRatio, cameraToWorld, camera.origin);
+	//Skipped tiles keep their previous colors, the passes below only work on the traced ones
+	const size_t nrCollectedTiles{ m_ActiveTiles.size() };
+	std::erase_if(m_ActiveTiles, [this](uint32_t tileIndex) { return m_PendingTiles[tileIndex] != 0; });
+	m_FrameStats.nrCompletedTiles += uint32_t(m_ActiveTiles.size());
+	m_FrameStats.nrSkippedTiles += uint32_t(nrCollectedTiles - m_ActiveTiles.size());
+
+	//Both need all traced pixels, also the neighbours in other tiles.
+	//Upsampling first, so the checkerboard gaps next to coarse tiles see their final colors.
+	const uint64_t reconstructStart{ SDL_GetPerformanceCounter() };
+#if defined(PARALLEL_EXECUTION)
+	std::for_each(std::execution::par, m_ActiveTiles.begin(), m_ActiveTiles.end(), [&](uint32_t tileIndex) {
+		UpsampleTile(tileIndex);
 		});
 #else
-	// synchronous
-	for (uint32_t pixelIndex {}; pixelIndex < amountOfPixels; pixelIndex++)
+	for (const uint32_t tileIndex : m_ActiveTiles)
 	{
-		RenderPixel(pScene, pixelIndex, FOV, aspectRatio, cameraToWorld, camera.origin);
+		UpsampleTile(tileIndex);
 	}
 #endif
 
-	//@END
-	//Update SDL Surface
-	SDL_UpdateWindowSurface(m_pWindow);
+	if (m_CheckerboardFrame)
+	{
+#if defined(PARALLEL_EXECUTION)
+		std::for_each(std::execution::par, m_ActiveTiles.begin(), m_ActiveTiles.end(), [&](uint32_t tileIndex) {
+			ReconstructTile(tileIndex, FOV, aspectRatio, cameraToWorld, scene.cameraOrigin);
+			});
+#else
+		for (const uint32_t tileIndex : m_ActiveTiles)
+		{
+			ReconstructTile(tileIndex, FOV, aspectRatio, cameraToWorld, scene.cameraOrigin);
+		}
+#endif
+	}
+	const uint64_t reconstructEnd{ SDL_GetPerformanceCounter() };
+
+	//Needs the final first pass colors of the neighbours, so the edges are detected before any pixel changes
+	const int antiAliasingGridSize{ int(sqrtf(float(m_AntiAliasingSamples))) };
+	if (antiAliasingGridSize > 1)
+	{
+#if defined(PARALLEL_EXECUTION)
+		std::for_each(std::execution::par, m_ActiveTiles.begin(), m_ActiveTiles.end(), [&](uint32_t tileIndex) {
+			DetectEdges(tileIndex);
+			});
+		std::for_each(std::execution::par, m_ActiveTiles.begin(), m_ActiveTiles.end(), [&](uint32_t tileIndex) {
+			AntiAliasTile(scene, tileIndex, antiAliasingGridSize, FOV, aspectRatio, cameraToWorld, scene.cameraOrigin);
+			});
+#else
+		for (const uint32_t tileIndex : m_ActiveTiles)
+		{
+			DetectEdges(tileIndex);
+		}
+		for (const uint32_t tileIndex : m_ActiveTiles)
+		{
+			AntiAliasTile(scene, tileIndex, antiAliasingGridSize, FOV, aspectRatio, cameraToWorld, scene.cameraOrigin);
+		}
+#endif
+	}
+	const uint64_t antiAliasingEnd{ SDL_GetPerformanceCounter() };
+
+	const float secondsPerCount{ 1.f / SDL_GetPerformanceFrequency() };
+	m_FrameStats.traceTime += ((reconstructStart - traceStart) + (antiAliasingEnd - reconstructEnd)) * secondsPerCount;
+	m_FrameStats.reconstructTime += (reconstructEnd - reconstructStart) * secondsPerCount;
+	for (const uint32_t tileIndex : m_ActiveTiles)
+	{
+		const int startX{ int(tileIndex % m_NrTilesX) * TILE_SIZE }, startY{ int(tileIndex / m_NrTilesX) * TILE_SIZE };
+		m_FrameStats.nrPixels += uint32_t((std::min(startX + TILE_SIZE, m_Width) - startX) * (std::min(startY + TILE_SIZE, m_Height) - startY));
+	}
+
+	m_RenderedCameraToWorld = cameraToWorld;
+	m_RenderedCameraOrigin = scene.cameraOrigin;
+	m_RenderedFov = FOV;
+
+	m_RenderedTileCount = uint32_t(m_ActiveTiles.size());
+	m_SampleCount = *std::min_element(m_TileSampleCounts.begin(), m_TileSampleCounts.end());
 }
 
-void Renderer::RenderPixel(Scene* pScene, uint32_t pixelIndex, const float fov, const float aspectRatio, const Matrix cameraToWorld, const Vector3 cameraOrigin) const
+void Renderer::WriteOutput(std::vector<uint32_t>& frameBuffer)
 {
-	auto& materials = pScene->GetMaterials();
-	auto& lights = pScene->GetLights();
+	const float scaleX{ m_Width / static_cast<float>(m_WindowWidth) };
+	const float scaleY{ m_Height / static_cast<float>(m_WindowHeight) };
+	const bool isUpscaling{ m_Width != m_WindowWidth || m_Height != m_WindowHeight };
+	const std::vector<ColorRGB>& colors{ GetOutputColors() };
 
-	const uint32_t px{ pixelIndex % m_Width }, py{ pixelIndex / m_Width };
+	auto writeRow = [&](uint32_t row)
+	{
+		uint32_t* pPixels{ frameBuffer.data() + size_t(row) * m_WindowWidth };
+		if (!isUpscaling)
+		{
+			PackRow(colors.data() + size_t(row) * m_Width, pPixels, m_WindowWidth);
+			return;
+		}
 
-	const float xValue{ (2.f * (float(px) + 0.5f) / m_Width - 1.f) * aspectRatio * fov };
-	const float yValue{ (1.f - 2.f * (float(py) + 0.5f) / m_Height) * fov };
+		ColorRGB* pColors{ m_UpscaleBuffer.data() + size_t(row) * m_WindowWidth };
+		for (int x{}; x < m_WindowWidth; ++x)
+		{
+			//Bilinear filter between the four closest render pixel centres
+			const float sourceX{ std::clamp((x + .5f) * scaleX - .5f, 0.f, float(m_Width - 1)) };
+			const float sourceY{ std::clamp((row + .5f) * scaleY - .5f, 0.f, float(m_Height - 1)) };
+			const int x0{ int(sourceX) }, y0{ int(sourceY) };
+			const int x1{ std::min(x0 + 1, m_Width - 1) }, y1{ std::min(y0 + 1, m_Height - 1) };
+			const float fractionX{ sourceX - x0 }, fractionY{ sourceY - y0 };
 
-	Vector3 rayDirection{ xValue, yValue, 1.f };
-	rayDirection = cameraToWorld.TransformVector(rayDirection);
-	rayDirection.Normalize();
+			const ColorRGB top{ ColorRGB::Lerp(colors[x0 + y0 * m_Width], colors[x1 + y0 * m_Width], fractionX) };
+			const ColorRGB bottom{ ColorRGB::Lerp(colors[x0 + y1 * m_Width], colors[x1 + y1 * m_Width], fractionX) };
+			pColors[x] = ColorRGB::Lerp(top, bottom, fractionY);
+		}
+		PackRow(pColors, pPixels, m_WindowWidth);
+	};
 
-	Ray viewRay{ cameraOrigin, rayDirection };
+#if defined(PARALLEL_EXECUTION)
+	std::for_each(std::execution::par, m_OutputRows.begin(), m_OutputRows.end(), writeRow);
+#else
+	std::for_each(m_OutputRows.begin(), m_OutputRows.end(), writeRow);
+#endif
+}
 
-	ColorRGB finalColor{};
-	HitRecord closestHit{};
+void Renderer::PackRow(const ColorRGB* pColors, uint32_t* pPixels, int count) const
+{
+	//Unknown layouts: let SDL map every pixel
+	if (!m_OutputFormat.isPacked)
+	{
+		for (int x{}; x < count; ++x)
+		{
+			const ColorRGB finalColor{ ToneMap(pColors[x]) };
+			pPixels[x] = SDL_MapRGB(m_pBuffer->format,
+				static_cast<uint8_t>(finalColor.r * 255),
+				static_cast<uint8_t>(finalColor.g * 255),
+				static_cast<uint8_t>(finalColor.b * 255));
+		}
+		return;
+	}
 
-	pScene->GetClosestHit(viewRay, closestHit);
-	if (closestHit.didHit)
+	int x{};
+#if defined(SIMD_OUTPUT)
+	static_assert(sizeof(ColorRGB) == 3 * sizeof(float), "Colors are loaded as packed floats");
+
+	const __m128 one{ _mm_set1_ps(1.f) };
+	const __m128 zero{ _mm_setzero_ps() };
+	const __m128 maxByte{ _mm_set1_ps(255.f) };
+	const __m128 exposure{ _mm_set1_ps(m_FrameExposure) };
+	const __m128i redShift{ _mm_cvtsi32_si128(int(m_OutputFormat.redShift)) };
+	const __m128i greenShift{ _mm_cvtsi32_si128(int(m_OutputFormat.greenShift)) };
+	const __m128i blueShift{ _mm_cvtsi32_si128(int(m_OutputFormat.blueShift)) };
+	const __m128i alpha{ _mm_set1_epi32(int(m_OutputFormat.alphaMask)) };
+
+	//Per channel operators, same math as ToneMap
+	auto toneMapChannel = [&](__m128 channel)
 	{
-		for (const Light& light : lights)
+		if (m_FrameToneMapping == ToneMapping::Reinhard)
+			return _mm_div_ps(channel, _mm_add_ps(channel, one));
+
+		const __m128 numerator{ _mm_mul_ps(channel, _mm_add_ps(_mm_mul_ps(channel, _mm_set1_ps(2.51f)), _mm_set1_ps(.03f))) };
+		const __m128 denominator{ _mm_add_ps(_mm_mul_ps(channel, _mm_add_ps(_mm_mul_ps(channel, _mm_set1_ps(2.43f)), _mm_set1_ps(.59f))), _mm_set1_ps(.14f)) };
+		return _mm_div_ps(numerator, denominator);
+	};
+
+	for (; x + 4 <= count; x += 4)
+	{
+		//Four colors are 12 floats: r0 g0 b0 r1 | g1 b1 r2 g2 | b2 r3 g3 b3, shuffled into one register per channel
+		const float* pSource{ &pColors[x].r };
+		const __m128 first{ _mm_loadu_ps(pSource) };
+		const __m128 second{ _mm_loadu_ps(pSource + 4) };
+		const __m128 third{ _mm_loadu_ps(pSource + 8) };
+
+		const __m128 redHigh{ _mm_shuffle_ps(second, third, _MM_SHUFFLE(1, 0, 3, 2)) };
+		__m128 red{ _mm_shuffle_ps(first, redHigh, _MM_SHUFFLE(3, 0, 3, 0)) };
+		__m128 green{ _mm_shuffle_ps(_mm_shuffle_ps(first, second, _MM_SHUFFLE(0, 0, 1, 1)),
+			_mm_shuffle_ps(second, third, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)) };
+		__m128 blue{ _mm_shuffle_ps(_mm_shuffle_ps(first, second, _MM_SHUFFLE(1, 1, 2, 2)),
+			_mm_shuffle_ps(third, third, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0)) };
+
+		red = _mm_max_ps(_mm_mul_ps(red, exposure), zero);
+		green = _mm_max_ps(_mm_mul_ps(green, exposure), zero);
+		blue = _mm_max_ps(_mm_mul_ps(blue, exposure), zero);
+
+		if (m_FrameToneMapping == ToneMapping::Clamp)
+		{
+			//Same as MaxToOne: divide by the largest channel when it exceeds one
+			const __m128 divisor{ _mm_max_ps(_mm_max_ps(red, _mm_max_ps(green, blue)), one) };
+			red = _mm_div_ps(red, divisor);
+			green = _mm_div_ps(green, divisor);
+			blue = _mm_div_ps(blue, divisor);
+		}
+		else
+		{
+			red = toneMapChannel(red);
+			green = toneMapChannel(green);
+			blue = toneMapChannel(blue);
+		}
+
+		red = _mm_min_ps(_mm_max_ps(_mm_mul_ps(red, maxByte), zero), maxByte);
+		green = _mm_min_ps(_mm_max_ps(_mm_mul_ps(green, maxByte), zero), maxByte);
+		blue = _mm_min_ps(_mm_max_ps(_mm_mul_ps(blue, maxByte), zero), maxByte);
+
+		//Truncate like the scalar byte casts and shift every channel into place
+		__m128i pixels{ _mm_sll_epi32(_mm_cvttps_epi32(red), redShift) };
+		pixels = _mm_or_si128(pixels, _mm_sll_epi32(_mm_cvttps_epi32(green), greenShift));
+		pixels = _mm_or_si128(pixels, _mm_sll_epi32(_mm_cvttps_epi32(blue), blueShift));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pPixels + x), _mm_or_si128(pixels, alpha));
+	}
+#endif
+
+	//Remainder of the row, or all of it without SIMD
+	for (; x < count; ++x)
+	{
+		const ColorRGB finalColor{ ToneMap(pColors[x]) };
+		const uint32_t red{ static_cast<uint8_t>(std::clamp(finalColor.r, 0.f, 1.f) * 255) };
+		const uint32_t green{ static_cast<uint8_t>(std::clamp(finalColor.g, 0.f, 1.f) * 255) };
+		const uint32_t blue{ static_cast<uint8_t>(std::clamp(finalColor.b, 0.f, 1.f) * 255) };
+		pPixels[x] = red << m_OutputFormat.redShift | green << m_OutputFormat.greenShift
+			| blue << m_OutputFormat.blueShift | m_OutputFormat.alphaMask;
+	}
+}
+
+ColorRGB Renderer::ToneMap(ColorRGB color) const
+{
+	color *= m_FrameExposure;
+	color = { std::max(color.r, 0.f), std::max(color.g, 0.f), std::max(color.b, 0.f) };
+
+	auto toneMapChannel = [this](float channel)
+	{
+		if (m_FrameToneMapping == ToneMapping::Reinhard)
+			return channel / (channel + 1.f);
+		return std::clamp((channel * (2.51f * channel + .03f)) / (channel * (2.43f * channel + .59f) + .14f), 0.f, 1.f);
+	};
+
+	if (m_FrameToneMapping == ToneMapping::Clamp)
+	{
+		color.MaxToOne();
+		return color;
+	}
+	return { toneMapChannel(color.r), toneMapChannel(color.g), toneMapChannel(color.b) };
+}
+
+Renderer::LuminanceHistogram Renderer::BuildTileHistogram(uint32_t tileIndex) const
+{
+	LuminanceHistogram histogram{};
+
+	const int startX{ int(tileIndex % m_NrTilesX) * TILE_SIZE }, startY{ int(tileIndex / m_NrTilesX) * TILE_SIZE };
+	const int endX{ std::min(startX + TILE_SIZE, m_Width) }, endY{ std::min(startY + TILE_SIZE, m_Height) };
+	const float minLuminance{ exp2f(MIN_LOG_LUMINANCE) };
+	const float binsPerStop{ HISTOGRAM_BIN_COUNT / (MAX_LOG_LUMINANCE - MIN_LOG_LUMINANCE) };
+
+	for (int y{ startY }; y < endY; ++y)
+	{
+		for (int x{ startX }; x < endX; ++x)
+		{
+			const ColorRGB& color{ GetOutputColors()[x + y * m_Width] };
+			const float luminance{ .2126f * color.r + .7152f * color.g + .0722f * color.b };
+			if (luminance < minLuminance)
+				continue;
+
+			const int bin{ int((log2f(luminance) - MIN_LOG_LUMINANCE) * binsPerStop) };
+			++histogram[std::min(bin, HISTOGRAM_BIN_COUNT - 1)];
+		}
+	}
+
+	return histogram;
+}
+
+void Renderer::Denoise()
+{
+	const uint64_t denoiseStart{ SDL_GetPerformanceCounter() };
+	if (m_DenoisedBuffer.size() != m_ColorBuffer.size())
+	{
+		m_DenoisedBuffer.resize(m_ColorBuffer.size());
+		m_DenoiseScratch.resize(m_ColorBuffer.size());
+	}
+
+	//Every pass reads the neighbours of other tiles, so each one has to finish before the next starts
+	const auto firstTile{ m_TileIndices.begin() };
+	const auto lastTile{ firstTile + size_t(m_NrTilesX) * m_NrTilesY };
+	auto forEachTile = [&](const auto& task)
+	{
+#if defined(PARALLEL_EXECUTION)
+		std::for_each(std::execution::par, firstTile, lastTile, task);
+#else
+		std::for_each(firstTile, lastTile, task);
+#endif
+	};
+	auto forEachPixel = [this](uint32_t tileIndex, const auto& task)
+	{
+		const int startX{ int(tileIndex % m_NrTilesX) * TILE_SIZE }, startY{ int(tileIndex / m_NrTilesX) * TILE_SIZE };
+		const int endX{ std::min(startX + TILE_SIZE, m_Width) }, endY{ std::min(startY + TILE_SIZE, m_Height) };
+		for (int y{ startY }; y < endY; ++y)
+		{
+			for (int x{ startX }; x < endX; ++x)
+				task(uint32_t(x + y * m_Width));
+		}
+	};
+
+	//Only the lighting is filtered, the albedo is divided out and multiplied back in afterwards
+	forEachTile([&](uint32_t tileIndex)
+		{
+			forEachPixel(tileIndex, [this](uint32_t pixelIndex)
+				{
+					const GBufferSample& surface{ m_GBuffer[pixelIndex] };
+					const ColorRGB& color{ m_ColorBuffer[pixelIndex] };
+					if (surface.depth == FLT_MAX)
+					{
+						m_DenoisedBuffer[pixelIndex] = color;
+						return;
+					}
+					const ColorRGB& albedo{ m_MaterialAlbedos[surface.materialIndex] };
+					m_DenoisedBuffer[pixelIndex] = { color.r / std::max(albedo.r, DENOISE_MIN_ALBEDO), color.g / std::max(albedo.g, DENOISE_MIN_ALBEDO),
+						color.b / std::max(albedo.b, DENOISE_MIN_ALBEDO) };
+				});
+		});
+
+	std::vector<ColorRGB>* pSource{ &m_DenoisedBuffer };
+	std::vector<ColorRGB>* pDestination{ &m_DenoiseScratch };
+	for (int iteration{}; iteration < DENOISE_ITERATIONS; ++iteration)
+	{
+		const int stepSize{ 1 << iteration };
+		forEachTile([&](uint32_t tileIndex) { DenoiseTile(tileIndex, stepSize, DENOISE_LUMINANCE_SIGMA / stepSize, *pSource, *pDestination); });
+		std::swap(pSource, pDestination);
+	}
+
+	forEachTile([&](uint32_t tileIndex)
 		{
-			const Vector3 lightDirection{ LightUtils::GetDirectionToLight(light, closestHit.origin) };
-			Ray rayToLight{ closestHit.origin + closestHit.normal * 0.001f, lightDirection.Normalized() };
-			if (light.type == LightType::Point) rayToLight.max = lightDirection.Magnitude();
-			else rayToLight.max = FLT_MAX;
+			forEachPixel(tileIndex, [&](uint32_t pixelIndex)
+				{
+					const GBufferSample& surface{ m_GBuffer[pixelIndex] };
+					const ColorRGB& lighting{ (*pSource)[pixelIndex] };
+					if (surface.depth == FLT_MAX)
+					{
+						m_DenoisedBuffer[pixelIndex] = lighting;
+						return;
+					}
+					const ColorRGB& albedo{ m_MaterialAlbedos[surface.materialIndex] };
+					m_DenoisedBuffer[pixelIndex] = { lighting.r * std::max(albedo.r, DENOISE_MIN_ALBEDO), lighting.g * std::max(albedo.g, DENOISE_MIN_ALBEDO),
+						lighting.b * std::max(albedo.b, DENOISE_MIN_ALBEDO) };
+				});
+		});
 
-			// Observed area calc + early escape
-			const float observedArea{ Vector3::Dot(closestHit.normal, lightDirection) / lightDirection.Magnitude() };
-			if (observedArea <= 0.f) continue;
+	m_DenoiseTime = (SDL_GetPerformanceCounter() - denoiseStart) / float(SDL_GetPerformanceFrequency());
+}
+
+void Renderer::DenoiseTile(uint32_t tileIndex, int stepSize, float luminanceSigma, const std::vector<ColorRGB>& source, std::vector<ColorRGB>& destination) const
+{
+	//B3 spline, spread out over the step size (holes between the taps, "a trous")
+	constexpr float kernel[]{ 1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+	auto getLuminance = [](const ColorRGB& color)
+	{
+		return .2126f * color.r + .7152f * color.g + .0722f * color.b;
+	};
 
-			// Shadows
-			if (pScene->DoesHit(rayToLight) && m_ShadowsEnabled) continue;
+	const int startX{ int(tileIndex % m_NrTilesX) * TILE_SIZE }, startY{ int(tileIndex / m_NrTilesX) * TILE_SIZE };
+	const int endX{ std::min(startX + TILE_SIZE, m_Width) }, endY{ std::min(startY + TILE_SIZE, m_Height) };
+	for (int y{ startY }; y < endY; ++y)
+	{
+		for (int x{ startX }; x < endX; ++x)
+		{
+			const uint32_t pixelIndex{ uint32_t(x + y * m_Width) };
+			const GBufferSample& surface{ m_GBuffer[pixelIndex] };
+			if (surface.depth == FLT_MAX)
+			{
+				destination[pixelIndex] = source[pixelIndex];
+				continue;
+			}
 
+			const ColorRGB& albedo{ m_MaterialAlbedos[surface.materialIndex] };
+			const float luminance{ getLuminance(source[pixelIndex]) };
+			const float luminanceScale{ -1.f / (luminanceSigma * (luminance + DENOISE_MIN_ALBEDO)) };
+			const float depthScale{ -1.f / (DENOISE_DEPTH_SIGMA * surface.depth) };
 
-			switch (m_CurrentLightingMode)
+			ColorRGB sum{};
+			float totalWeight{};
+			for (int offsetY{ -2 }; offsetY <= 2; ++offsetY)
 			{
-			case dae::Renderer::LightingMode::ObservedArea:
-				finalColor += {observedArea, observedArea, observedArea};
-				break;
-			case dae::Renderer::LightingMode::Radience:
-				finalColor += LightUtils::GetRadiance(light, closestHit.origin);
-				break;
-			case dae::Renderer::LightingMode::BRDF:
-				finalColor += materials[closestHit.materialIndex]->Shade(closestHit, rayToLight.direction, -rayDirection);
-				break;
-			case dae::Renderer::LightingMode::Combined:
-				finalColor += LightUtils::GetRadiance(light, closestHit.origin) *
-					materials[closestHit.materialIndex]->Shade(closestHit, rayToLight.direction, -rayDirection) *
-					observedArea;
-				break;
+				const int sampleY{ y + offsetY * stepSize };
+				if (sampleY < 0 || sampleY >= m_Height)
+					continue;
+
+				for (int offsetX{ -2 }; offsetX <= 2; ++offsetX)
+				{
+					const int sampleX{ x + offsetX * stepSize };
+					if (sampleX < 0 || sampleX >= m_Width)
+						continue;
+
+					const uint32_t sampleIndex{ uint32_t(sampleX + sampleY * m_Width) };
+					const GBufferSample& neighbour{ m_GBuffer[sampleIndex] };
+					const float cosine{ Vector3::Dot(surface.normal, neighbour.normal) };
+					if (neighbour.depth == FLT_MAX || cosine <= 0.f)
+						continue;
+
+					const ColorRGB& neighbourAlbedo{ m_MaterialAlbedos[neighbour.materialIndex] };
+					const ColorRGB& sampleColor{ source[sampleIndex] };
+					const float albedoDistance{ Square(albedo.r - neighbourAlbedo.r) + Square(albedo.g - neighbourAlbedo.g) + Square(albedo.b - neighbourAlbedo.b) };
+					const float pixelDistance{ sqrtf(float(offsetX * offsetX + offsetY * offsetY)) * stepSize };
+
+					float normalWeight{ cosine };
+					for (int power{ 1 }; power < DENOISE_NORMAL_POWER; power *= 2)
+						normalWeight *= normalWeight;
+
+					const float weight{ kernel[offsetX + 2] * kernel[offsetY + 2] * normalWeight *
+						expf(fabsf(neighbour.depth - surface.depth) * depthScale / std::max(pixelDistance, 1.f) +
+							fabsf(getLuminance(sampleColor) - luminance) * luminanceScale -
+							albedoDistance / Square(DENOISE_ALBEDO_SIGMA)) };
+					sum += sampleColor * weight;
+					totalWeight += weight;
+				}
 			}
+
+			//The pixel itself always has a weight
+			destination[pixelIndex] = sum * (1.f / totalWeight);
 		}
 	}
+}
+
+void Renderer::UpdateExposure()
+{
+	m_OutputPostVersion = m_PostVersion;
+	m_FrameToneMapping = m_CurrentToneMapping;
+	float stops{ m_ExposureCompensation };
+
+	if (!m_AutoExposureEnabled)
+	{
+		//Re-enabling starts from the measured exposure instead of adapting from a stale one
+		m_IsExposureAdapting = false;
+		m_LastExposureUpdate = 0;
+		m_FrameExposure = exp2f(stops);
+		m_Exposure = m_FrameExposure;
+		return;
+	}
+
+	//Histograms per tile, summed in a parallel reduction
+	const auto firstTile{ m_TileIndices.begin() };
+	const auto lastTile{ firstTile + size_t(m_NrTilesX) * m_NrTilesY };
+	auto addHistograms = [](LuminanceHistogram sum, const LuminanceHistogram& histogram)
+	{
+		for (int bin{}; bin < HISTOGRAM_BIN_COUNT; ++bin)
+			sum[bin] += histogram[bin];
+		return sum;
+	};
+	auto buildHistogram = [this](uint32_t tileIndex) { return BuildTileHistogram(tileIndex); };
+#if defined(PARALLEL_EXECUTION)
+	const LuminanceHistogram histogram{ std::transform_reduce(std::execution::par, firstTile, lastTile, LuminanceHistogram{}, addHistograms, buildHistogram) };
+#else
+	const LuminanceHistogram histogram{ std::transform_reduce(firstTile, lastTile, LuminanceHistogram{}, addHistograms, buildHistogram) };
+#endif
+
+	//Average log luminance of the pixels between the percentiles, bins on the border count partially
+	const uint32_t nrPixels{ std::accumulate(histogram.begin(), histogram.end(), 0u) };
+	const float low{ nrPixels * EXPOSURE_LOW_PERCENTILE }, high{ nrPixels * EXPOSURE_HIGH_PERCENTILE };
+	const float stopsPerBin{ (MAX_LOG_LUMINANCE - MIN_LOG_LUMINANCE) / HISTOGRAM_BIN_COUNT };
+	float weightedSum{}, totalWeight{}, below{};
+	for (int bin{}; bin < HISTOGRAM_BIN_COUNT; ++bin)
+	{
+		const float above{ below + histogram[bin] };
+		const float weight{ std::max(0.f, std::min(above, high) - std::max(below, low)) };
+		weightedSum += weight * (MIN_LOG_LUMINANCE + (bin + .5f) * stopsPerBin);
+		totalWeight += weight;
+		below = above;
+	}
+	const float targetStops{ totalWeight > 0.f ? log2f(EXPOSURE_KEY) - weightedSum / totalWeight : m_AdaptedStops };
 
-	//Update Color in Buffer
-	finalColor.MaxToOne();
+	//Snap on the first measurement, afterwards close the gap gradually. Long pauses count as one step.
+	const uint64_t currentTime{ SDL_GetPerformanceCounter() };
+	if (m_LastExposureUpdate == 0)
+	{
+		m_AdaptedStops = targetStops;
+	}
+	else
+	{
+		const float elapsed{ std::min((currentTime - m_LastExposureUpdate) / float(SDL_GetPerformanceFrequency()), .1f) };
+		m_AdaptedStops += (targetStops - m_AdaptedStops) * (1.f - expf(-EXPOSURE_ADAPTATION_RATE * elapsed));
+	}
+	m_LastExposureUpdate = currentTime;
 
-	m_pBufferPixels[px + (py * m_Width)] = SDL_MapRGB(m_pBuffer->format,
-		static_cast<uint8_t>(finalColor.r * 255),
-		static_cast<uint8_t>(finalColor.g * 255),
-		static_cast<uint8_t>(finalColor.b * 255));
+	m_IsExposureAdapting = fabsf(targetStops - m_AdaptedStops) > EXPOSURE_CONVERGED_STOPS;
+	if (!m_IsExposureAdapting)
+		m_AdaptedStops = targetStops;
+
+	m_FrameExposure = exp2f(stops + m_AdaptedStops);
+	m_Exposure = m_FrameExposure;
 }
 
-bool Renderer::SaveBufferToImage() const
+bool Renderer::NeedsPostUpdate() const
 {
-	return SDL_SaveBMP(m_pBuffer, "RayTracing_Buffer.bmp");
+	return m_PostVersion != m_OutputPostVersion || (m_AutoExposureEnabled && m_IsExposureAdapting);
+}
+
+void Renderer::HandOverFrame(uint64_t inputTimestamp)
+{
+	std::vector<uint32_t>& frameBuffer{ m_FrameBuffers[m_WriteIndex] };
+	const uint64_t postStart{ SDL_GetPerformanceCounter() };
+	m_IsOutputDenoised = m_DenoiserEnabled && !m_MaterialAlbedos.empty();
+	if (m_IsOutputDenoised)
+		Denoise();
+	UpdateExposure();
+	WriteOutput(frameBuffer);
+	m_FrameStats.postTime += (SDL_GetPerformanceCounter() - postStart) / float(SDL_GetPerformanceFrequency());
+
+	//Debug: outline the tiles that were traced this frame, only in the handed over copy
+	if (m_ShowTileOverlay)
+	{
+		const uint32_t overlayColor{ SDL_MapRGB(m_pBuffer->format, 0, 255, 0) };
+		const float scaleX{ m_WindowWidth / static_cast<float>(m_Width) };
+		const float scaleY{ m_WindowHeight / static_cast<float>(m_Height) };
+		for (const uint32_t tileIndex : m_ActiveTiles)
+		{
+			const int tileX{ int(tileIndex % m_NrTilesX) * TILE_SIZE }, tileY{ int(tileIndex / m_NrTilesX) * TILE_SIZE };
+			const int startX{ int(tileX * scaleX) }, startY{ int(tileY * scaleY) };
+			const int endX{ std::min(int((tileX + TILE_SIZE) * scaleX), m_WindowWidth) - 1 };
+			const int endY{ std::min(int((tileY + TILE_SIZE) * scaleY), m_WindowHeight) - 1 };
+			for (int x{ startX }; x <= endX; ++x)
+			{
+				frameBuffer[x + startY * m_WindowWidth] = overlayColor;
+				frameBuffer[x + endY * m_WindowWidth] = overlayColor;
+			}
+			for (int y{ startY }; y <= endY; ++y)
+			{
+				frameBuffer[startX + y * m_WindowWidth] = overlayColor;
+				frameBuffer[endX + y * m_WindowWidth] = overlayColor;
+			}
+		}
+	}
+
+	//Hand the finished back buffer over, Present() picks it up on the main thread
+	{
+		std::lock_guard lock{ m_FrameMutex };
+		m_FrameTimestamps[m_WriteIndex] = inputTimestamp;
+		std::swap(m_WriteIndex, m_ReadyIndex);
+		m_HasNewFrame = true;
+	}
+	m_FrameCondition.notify_one();
+}
+
+bool Renderer::CollectTiles(const SceneSnapshot& scene)
+{
+	m_ActiveTiles.clear();
+	std::fill(m_DirtyTiles.begin(), m_DirtyTiles.end(), uint8_t(0));
+
+	const uint32_t settingsVersion{ m_SettingsVersion };
+	const bool isFullChange{ !m_HasRendered || !(scene.versions == m_RenderedVersions) || settingsVersion != m_RenderedSettingsVersion ||
+		scene.triangleMeshGeometries.size() != m_RenderedMeshes.size() };
+
+	//Camera and geometry changes are caught by reprojection and validation, other changes make the old colors wrong
+	m_IsHistoryValid = m_HasRendered && settingsVersion == m_RenderedSettingsVersion &&
+		scene.versions.lights == m_RenderedVersions.lights && scene.versions.materials == m_RenderedVersions.materials;
+
+	//Cached lighting also needs static geometry, a moving mesh or primitive changes the shadows on everything around it
+	bool hasMovedMeshes{ scene.triangleMeshGeometries.size() != m_RenderedMeshes.size() };
+	for (size_t meshIndex{}; !hasMovedMeshes && meshIndex < scene.triangleMeshGeometries.size(); ++meshIndex)
+	{
+		hasMovedMeshes = scene.triangleMeshGeometries[meshIndex].version != m_RenderedMeshes[meshIndex].version;
+	}
+	const bool hasChangedGeometry{ scene.versions.geometry != m_RenderedVersions.geometry };
+	m_IsCacheValid = m_IsHistoryValid && !hasMovedMeshes && !hasChangedGeometry;
+
+	//The radiance cache is in world space, it survives camera moves. Moving meshes only evict the cells they may shadow or occlude,
+	//within the box around their old and new place. When that means too many box and shadow ray tests, the cache is cleared instead.
+	//Changed primitives have no box to evict by, they clear it.
+	const uint64_t evictStart{ SDL_GetPerformanceCounter() };
+	uint32_t nrEvicted{};
+	if (!m_IsHistoryValid || hasChangedGeometry || scene.triangleMeshGeometries.size() != m_RenderedMeshes.size())
+	{
+		nrEvicted = m_RadianceCache.GetEntryCount();
+		m_RadianceCache.Clear();
+	}
+	else if (m_RadianceCacheFrame && hasMovedMeshes)
+	{
+		size_t nrMovedMeshes{};
+		for (size_t meshIndex{}; meshIndex < scene.triangleMeshGeometries.size(); ++meshIndex)
+		{
+			if (scene.triangleMeshGeometries[meshIndex].version != m_RenderedMeshes[meshIndex].version)
+				++nrMovedMeshes;
+		}
+
+		const size_t nrTests{ size_t(m_RadianceCache.GetEntryCount()) * nrMovedMeshes * (1 + (m_ShadowsEnabled ? scene.lights.size() : 0)) };
+		if (nrTests > RADIANCE_CACHE_MAX_EVICT_TESTS)
+		{
+			nrEvicted = m_RadianceCache.GetEntryCount();
+			m_RadianceCache.Clear();
+		}
+		else
+		{
+			const float occlusionRadius{ m_AoFrame ? AO_RADIUS : 0.f };
+			for (size_t meshIndex{}; meshIndex < scene.triangleMeshGeometries.size(); ++meshIndex)
+			{
+				const TriangleMesh& mesh{ scene.triangleMeshGeometries[meshIndex] };
+				const RenderedMesh& renderedMesh{ m_RenderedMeshes[meshIndex] };
+				if (mesh.version == renderedMesh.version)
+					continue;
+
+				const Vector3 minAABB{ Vector3::Min(renderedMesh.minAABB, mesh.transformedMinAABB) };
+				const Vector3 maxAABB{ Vector3::Max(renderedMesh.maxAABB, mesh.transformedMaxAABB) };
+				nrEvicted += m_RadianceCache.Evict(minAABB, maxAABB, scene.lights, occlusionRadius, m_ShadowsEnabled);
+			}
+		}
+	}
+	m_RadianceEvictTime = (SDL_GetPerformanceCounter() - evictStart) / float(SDL_GetPerformanceFrequency());
+	m_RadianceEvictCount = nrEvicted;
+
+	bool hasChanged{ isFullChange };
+	if (isFullChange)
+	{
+		std::fill(m_DirtyTiles.begin(), m_DirtyTiles.end(), uint8_t(1));
+		m_RenderedMeshes.resize(scene.triangleMeshGeometries.size());
+	}
+	else
+	{
+		//Only meshes moved and the camera is static: refresh their old and new footprint (+ shadows)
+		for (size_t meshIndex{}; meshIndex < scene.triangleMeshGeometries.size(); ++meshIndex)
+		{
+			const TriangleMesh& mesh{ scene.triangleMeshGeometries[meshIndex] };
+			const RenderedMesh& renderedMesh{ m_RenderedMeshes[meshIndex] };
+			if (mesh.version == renderedMesh.version)
+				continue;
+
+			hasChanged = true;
+			//Mirrors and glass can show the mesh anywhere
+			if (!m_IncrementalEnabled || m_SpecularFrame)
+			{
+				std::fill(m_DirtyTiles.begin(), m_DirtyTiles.end(), uint8_t(1));
+				break;
+			}
+
+			MarkDirtyBox(scene, renderedMesh.minAABB, renderedMesh.maxAABB);
+			MarkDirtyBox(scene, mesh.transformedMinAABB, mesh.transformedMaxAABB);
+		}
+
+		//Tiles that moved in or out of a shading rate region
+		for (size_t tileIndex{}; tileIndex < m_TileRates.size(); ++tileIndex)
+		{
+			if (m_TileRates[tileIndex] != m_RenderedTileRates[tileIndex])
+			{
+				m_DirtyTiles[tileIndex] = 1;
+				hasChanged = true;
+			}
+		}
+	}
+	m_RenderedTileRates = m_TileRates;
+
+	m_HasRendered = true;
+	m_RenderedVersions = scene.versions;
+	m_RenderedSettingsVersion = settingsVersion;
+	for (size_t meshIndex{}; meshIndex < scene.triangleMeshGeometries.size(); ++meshIndex)
+	{
+		const TriangleMesh& mesh{ scene.triangleMeshGeometries[meshIndex] };
+		m_RenderedMeshes[meshIndex] = { mesh.version, mesh.transformedMinAABB, mesh.transformedMaxAABB };
+	}
+
+	for (uint32_t tileIndex{}; tileIndex < m_DirtyTiles.size(); ++tileIndex)
+	{
+		//Cut off while dirty, before its first sample: it still holds the old scene and possibly a stale half trace
+		if (m_PendingTiles[tileIndex] && m_TileSampleCounts[tileIndex] == 0)
+			m_DirtyTiles[tileIndex] = 1;
+
+		if (m_DirtyTiles[tileIndex])
+		{
+			//Restart from a single sample through the pixel centre
+			m_TileSampleCounts[tileIndex] = 0;
+			m_ActiveTiles.push_back(tileIndex);
+		}
+		else if (m_PendingTiles[tileIndex])
+		{
+			//Cut off by the deadline while refining or completing, its samples so far stay valid
+			m_ActiveTiles.push_back(tileIndex);
+		}
+		else if (m_HalfTracedTiles[tileIndex])
+		{
+			//Checkerboarded last frame and unchanged since, trace the other half
+			m_ActiveTiles.push_back(tileIndex);
+		}
+		else if (!hasChanged && m_AccumulateFrame && m_TileSampleCounts[tileIndex] < MAX_ACCUMULATED_SAMPLES)
+		{
+			//Identical frame, refine whatever has samples left to accumulate
+			m_ActiveTiles.push_back(tileIndex);
+		}
+	}
+
+	//Fewest samples first, then the ones cut off last frame, otherwise the same tiles would miss the deadline every frame
+	if (m_BudgetFrame)
+	{
+		std::stable_sort(m_ActiveTiles.begin(), m_ActiveTiles.end(), [this](uint32_t a, uint32_t b)
+			{
+				if (m_TileSampleCounts[a] != m_TileSampleCounts[b])
+					return m_TileSampleCounts[a] < m_TileSampleCounts[b];
+				return m_PendingTiles[a] > m_PendingTiles[b];
+			});
+	}
+
+	return !m_ActiveTiles.empty();
+}
+
+void Renderer::MarkDirtyBox(const SceneSnapshot& scene, const Vector3& minAABB, const Vector3& maxAABB)
+{
+	Vector3 corners[8]{};
+	for (int cornerIndex{}; cornerIndex < 8; ++cornerIndex)
+	{
+		corners[cornerIndex] = {
+			(cornerIndex & 1) ? maxAABB.x : minAABB.x,
+			(cornerIndex & 2) ? maxAABB.y : minAABB.y,
+			(cornerIndex & 4) ? maxAABB.z : minAABB.z };
+	}
+	MarkDirtyPoints(scene, corners, 8);
+
+	if (!m_ShadowsEnabled)
+		return;
+
+	//Shadow volume: the box extruded away from every light, far enough to leave any receiver behind.
+	//Area lights extrude it away from every corner of their bounds, which also covers the penumbra.
+	constexpr float extrusionDistance{ 1000.f };
+	Vector3 shadowVolume[MAX_HULL_POINTS]{};
+	std::copy(corners, corners + 8, shadowVolume);
+	for (const Light& light : scene.lights)
+	{
+		const float extent{ LightUtils::GetExtent(light) };
+		const int nrLightCorners{ extent > 0.f ? 8 : 1 };
+		for (int lightCorner{}; lightCorner < nrLightCorners; ++lightCorner)
+		{
+			Light cornerLight{ light };
+			cornerLight.origin += Vector3{
+				(lightCorner & 1) ? extent : -extent,
+				(lightCorner & 2) ? extent : -extent,
+				(lightCorner & 4) ? extent : -extent };
+
+			for (int cornerIndex{}; cornerIndex < 8; ++cornerIndex)
+			{
+				Vector3 extrusion{ -LightUtils::GetDirectionToLight(cornerLight, corners[cornerIndex]) };
+				if (extrusion.Normalize() <= 0.f)
+					extrusion = {};
+
+				shadowVolume[8 + lightCorner * 8 + cornerIndex] = corners[cornerIndex] + extrusion * extrusionDistance;
+			}
+		}
+
+		//A light inside the box can shadow any direction
+		const bool isLightInside{ light.type != LightType::Directional &&
+			light.origin.x >= minAABB.x - extent && light.origin.y >= minAABB.y - extent && light.origin.z >= minAABB.z - extent &&
+			light.origin.x <= maxAABB.x + extent && light.origin.y <= maxAABB.y + extent && light.origin.z <= maxAABB.z + extent };
+		if (isLightInside)
+		{
+			std::fill(m_DirtyTiles.begin(), m_DirtyTiles.end(), uint8_t(1));
+			return;
+		}
+
+		MarkDirtyPoints(scene, shadowVolume, 8 + nrLightCorners * 8);
+	}
+}
+
+void Renderer::MarkDirtyPoints(const SceneSnapshot& scene, const Vector3* pPoints, int nrPoints)
+{
+	//Marks the screen rect covering the convex hull of the points, clipped against the near plane
+	constexpr float nearPlane{ .01f };
+	const Vector3 right{ scene.cameraToWorld.GetAxisX() }, up{ scene.cameraToWorld.GetAxisY() }, forward{ scene.cameraToWorld.GetAxisZ() };
+
+	const float aspectRatio = m_Width / static_cast<float>(m_Height);
+	const float fov = tanf((scene.fovAngle * TO_RADIANS) / 2);
+
+	float minX{ FLT_MAX }, minY{ FLT_MAX }, maxX{ -FLT_MAX }, maxY{ -FLT_MAX };
+	auto addPoint = [&](const Vector3& cameraSpacePoint)
+	{
+		const float screenX{ (cameraSpacePoint.x / (cameraSpacePoint.z * aspectRatio * fov) + 1.f) * .5f * m_Width };
+		const float screenY{ (1.f - cameraSpacePoint.y / (cameraSpacePoint.z * fov)) * .5f * m_Height };
+		minX = std::min(minX, screenX);
+		minY = std::min(minY, screenY);
+		maxX = std::max(maxX, screenX);
+		maxY = std::max(maxY, screenY);
+	};
+
+	Vector3 cameraSpacePoints[MAX_HULL_POINTS]{};
+	for (int pointIndex{}; pointIndex < nrPoints; ++pointIndex)
+	{
+		const Vector3 toPoint{ pPoints[pointIndex] - scene.cameraOrigin };
+		cameraSpacePoints[pointIndex] = { Vector3::Dot(toPoint, right), Vector3::Dot(toPoint, up), Vector3::Dot(toPoint, forward) };
+	}
+
+	for (int pointIndex{}; pointIndex < nrPoints; ++pointIndex)
+	{
+		const Vector3& point{ cameraSpacePoints[pointIndex] };
+		if (point.z < nearPlane)
+			continue;
+
+		addPoint(point);
+
+		//Hull edges crossing the near plane, every pair is a superset of the real edges
+		for (int otherIndex{}; otherIndex < nrPoints; ++otherIndex)
+		{
+			const Vector3& other{ cameraSpacePoints[otherIndex] };
+			if (other.z >= nearPlane)
+				continue;
+
+			const float t{ (point.z - nearPlane) / (point.z - other.z) };
+			addPoint(point + (other - point) * t);
+		}
+	}
+
+	if (minX > maxX)
+		return;
+
+	//One pixel margin, the jittered samples are spread over the whole pixel
+	const int startTileX{ std::max(int(floorf(minX)) - 1, 0) / TILE_SIZE };
+	const int startTileY{ std::max(int(floorf(minY)) - 1, 0) / TILE_SIZE };
+	const int endTileX{ std::min(int(std::min(ceilf(maxX), float(m_Width))) + 1, m_Width - 1) / TILE_SIZE };
+	const int endTileY{ std::min(int(std::min(ceilf(maxY), float(m_Height))) + 1, m_Height - 1) / TILE_SIZE };
+
+	for (int tileY{ startTileY }; tileY <= endTileY; ++tileY)
+	{
+		for (int tileX{ startTileX }; tileX <= endTileX; ++tileX)
+		{
+			m_DirtyTiles[tileX + tileY * m_NrTilesX] = 1;
+		}
+	}
+}
+
+void Renderer::RenderTile(const SceneSnapshot& scene, uint32_t tileIndex, const float fov, const float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin)
+{
+	//Changed tiles trace half their pixels in checkerboard mode, the next frame completes them with the other half,
+	//which keeps the sample count at the single sample the gaps already got
+	//Coarse tiles are never checkerboarded, they already trace a quarter or less
+	const int blockSize{ m_TileRates[tileIndex] };
+	const bool isDirty{ m_DirtyTiles[tileIndex] != 0 };
+	const bool isCompletion{ !isDirty && m_HalfTracedTiles[tileIndex] };
+	const bool isHalfRate{ isCompletion || (isDirty && m_CheckerboardFrame && blockSize == 1) };
+	//The completion can come more than one frame later when the frame budget cut it off, so the half is stored per tile
+	const uint32_t parity{ isCompletion ? GetTracedParity(tileIndex) ^ 1u : m_CheckerboardParity };
+	m_HalfTracedTiles[tileIndex] = uint8_t(isHalfRate && !isCompletion ? 1 + parity : 0);
+
+	const uint64_t tileStart{ SDL_GetPerformanceCounter() };
+
+	//Each tile is rendered by a single thread, so its sample count can be updated without synchronization
+	const uint32_t sampleCount{ isCompletion ? m_TileSampleCounts[tileIndex] : ++m_TileSampleCounts[tileIndex] };
+
+	if (m_CullLightsFrame)
+		CullTileLights(scene, tileIndex, fov, aspectRatio, cameraToWorld, cameraOrigin);
+
+	const int startX{ int(tileIndex % m_NrTilesX) * TILE_SIZE }, startY{ int(tileIndex / m_NrTilesX) * TILE_SIZE };
+	const int endX{ std::min(startX + TILE_SIZE, m_Width) }, endY{ std::min(startY + TILE_SIZE, m_Height) };
+
+	//One ray per block, stored in its top-left pixel
+	uint32_t nrRays{}, nrCacheHits{};
+	for (int py{ startY }; py < endY; py += blockSize)
+	{
+		for (int px{ startX }; px < endX; px += blockSize)
+		{
+			if (isHalfRate && ((px + py + parity) & 1))
+				continue;
+
+			if (RenderPixel(scene, uint32_t(px + py * m_Width), fov, aspectRatio, cameraToWorld, cameraOrigin, sampleCount, blockSize))
+				++nrCacheHits;
+			++nrRays;
+		}
+	}
+	m_FrameRayCount += nrRays;
+	m_FrameCacheHits += nrCacheHits;
+	m_FrameTileTicks += SDL_GetPerformanceCounter() - tileStart;
+}
+
+bool Renderer::RenderPixel(const SceneSnapshot& scene, uint32_t pixelIndex, const float fov, const float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin, const uint32_t sampleCount, const int blockSize)
+{
+	const uint32_t px{ pixelIndex % m_Width }, py{ pixelIndex / m_Width };
+
+	//First sample goes through the pixel centre, extra samples take their sub-pixel offsets from the frame's Sampler (PCG, Sobol or blue noise)
+	float jitterX{ .5f }, jitterY{ .5f };
+	if (m_AccumulateFrame && sampleCount > 1)
+	{
+		jitterX = m_Sampler.Get(px, py, sampleCount - 1, 0);
+		jitterY = m_Sampler.Get(px, py, sampleCount - 1, 1);
+	}
+
+	//Only the first sample goes through the cache, jittered samples hit other points than the cached one.
+	//Resampling replaces the cache, both reuse the history in their own way.
+	GBufferSample surface{};
+	bool isCacheHit{ false };
+	ColorRGB finalColor{};
+	if (m_ResampleLightsFrame)
+		finalColor = TraceResampledPixel(scene, pixelIndex, GetViewRay(px + jitterX * blockSize, py + jitterY * blockSize, fov, aspectRatio, cameraToWorld, cameraOrigin), surface);
+	else if (m_CacheFrame && sampleCount <= 1)
+		finalColor = TraceCachedPixel(scene, pixelIndex, GetViewRay(px + jitterX * blockSize, py + jitterY * blockSize, fov, aspectRatio, cameraToWorld, cameraOrigin), surface, isCacheHit);
+	else
+		finalColor = TracePixel(scene, px + jitterX * blockSize, py + jitterY * blockSize, fov, aspectRatio, cameraToWorld, cameraOrigin, surface, sampleCount - 1);
+
+	//Describes the pixel centre, jittered samples only refine the color
+	if (sampleCount <= 1)
+		m_GBuffer[pixelIndex] = surface;
+
+	if (m_AccumulateFrame)
+	{
+		//Running average, the first sample overwrites whatever was accumulated before
+		ColorRGB& accumulated{ m_AccumulationBuffer[pixelIndex] };
+		if (sampleCount > 1) accumulated += finalColor;
+		else accumulated = finalColor;
+
+		//Through a const reference, the non-const ColorRGB operators modify the left operand
+		const ColorRGB& sum{ accumulated };
+		finalColor = sum * (1.f / sampleCount);
+	}
+
+	m_ColorBuffer[pixelIndex] = finalColor;
+	return isCacheHit;
+}
+
+ColorRGB Renderer::TraceCachedPixel(const SceneSnapshot& scene, uint32_t pixelIndex, const Ray& viewRay, GBufferSample& surface, bool& isCacheHit)
+{
+	HitRecord closestHit{};
+	scene.GetClosestHit(viewRay, closestHit);
+
+	CacheSample& cached{ m_Cache[pixelIndex] };
+	if (!closestHit.didHit)
+	{
+		cached = {};
+		return {};
+	}
+
+	surface = { closestHit.t, closestHit.materialIndex, closestHit.primitiveIndex, closestHit.normal };
+
+	//Every frame one pixel of each 4x4 block is shaded anyway, so view dependent lighting does not stick around
+	const uint32_t px{ pixelIndex % m_Width }, py{ pixelIndex / m_Width };
+	const bool isRefresh{ (px % 4) + (py % 4) * 4 == m_CacheFrameIndex % CACHE_REFRESH_INTERVAL };
+
+	//Reuse the shading of the previous frame if it saw the same point on the same primitive.
+	//Reflections and refractions move with the camera, they are always traced again.
+	const bool isSpecular{ m_SpecularFrame && scene.materials[closestHit.materialIndex]->HasSpecularScatter() };
+	uint32_t historyIndex{};
+	if (m_IsCacheValid && !isRefresh && !isSpecular && ProjectToHistory(closestHit.origin, historyIndex))
+	{
+		const CacheSample& history{ m_HistoryCache[historyIndex] };
+		if (history.isValid && history.primitiveIndex == closestHit.primitiveIndex && history.age < m_CacheMaxAge &&
+			(history.position - closestHit.origin).Magnitude() <= closestHit.t * CACHE_POSITION_TOLERANCE)
+		{
+			cached = { closestHit.origin, history.color, closestHit.primitiveIndex, history.age + 1, true };
+			isCacheHit = true;
+			return history.color;
+		}
+	}
+
+	const ColorRGB color{ ShadeHit(scene, closestHit, viewRay.direction, px, py, 0) };
+	cached = { closestHit.origin, color, closestHit.primitiveIndex, 0, true };
+	return color;
+}
+
+ColorRGB Renderer::TraceResampledPixel(const SceneSnapshot& scene, uint32_t pixelIndex, const Ray& viewRay, GBufferSample& surface)
+{
+	HitRecord closestHit{};
+	scene.GetClosestHit(viewRay, closestHit);
+
+	Reservoir& stored{ m_Reservoirs[pixelIndex] };
+	if (!closestHit.didHit)
+	{
+		stored = {};
+		return {};
+	}
+
+	surface = { closestHit.t, closestHit.materialIndex, closestHit.primitiveIndex, closestHit.normal };
+
+	//Directional lights are few and everywhere, they are not resampled
+	auto& lights = scene.lights;
+	const uint32_t px{ pixelIndex % m_Width }, py{ pixelIndex / m_Width };
+	ShadingContext context{ px, py, m_ResampleFrameIndex };
+	ColorRGB finalColor{ m_AoFrame ? ShadeAmbient(scene, closestHit, viewRay.direction, context) : ColorRGB{} };
+	for (const uint32_t lightIndex : m_LightTree.GetDirectionalLights())
+	{
+		finalColor += ShadeLight(scene, closestHit, lights[lightIndex], viewRay.direction, context);
+	}
+	m_FrameLightCount.fetch_add(m_LightTree.GetDirectionalLights().size() + 1, std::memory_order_relaxed);
+
+	//Target function: the unoccluded contribution of a light at this point
+	auto getTarget = [&](uint32_t lightIndex)
+	{
+		const ColorRGB contribution{ ShadeLight(scene, closestHit, lights[lightIndex], viewRay.direction, context, false) };
+		return std::max((contribution.r + contribution.g + contribution.b) / 3.f, 0.f);
+	};
+
+	//Candidates and history reservoirs with their resampling weights, one is kept in proportion to its weight
+	struct Candidate
+	{
+		uint32_t lightIndex{};
+		float target{};
+		float weight{};
+	};
+	std::array<Candidate, RESAMPLING_CANDIDATE_COUNT + RESAMPLING_NEIGHBOUR_COUNT> candidates{};
+	uint32_t nrStored{};
+	Reservoir reservoir{ closestHit.origin, closestHit.normal };
+
+	//Stratified over the light tree, which maps neighbouring random numbers to neighbouring lights.
+	//Weighted by target over source probability, candidates that find no light still count.
+	const float candidateOffset{ m_Sampler.Get(px, py, m_ResampleFrameIndex, LIGHT_SAMPLE_DIMENSION) };
+	for (uint32_t candidate{}; candidate < RESAMPLING_CANDIDATE_COUNT; ++candidate)
+	{
+		uint32_t lightIndex{};
+		float pdf{};
+		if (!m_LightTree.Sample(closestHit.origin, closestHit.normal, (candidate + candidateOffset) / RESAMPLING_CANDIDATE_COUNT, lightIndex, pdf))
+			continue;
+
+		const float target{ getTarget(lightIndex) };
+		candidates[nrStored++] = { lightIndex, target, target / pdf };
+	}
+	reservoir.nrCandidates = RESAMPLING_CANDIDATE_COUNT;
+
+	//Temporal and spatial reuse: the reservoir that saw this point in the previous frame and a few around it.
+	//Reservoirs of other surfaces are skipped, their lights were picked for another orientation or occlusion.
+	uint32_t historyIndex{};
+	if (m_IsHistoryValid && ProjectToHistory(closestHit.origin, historyIndex))
+	{
+		const int historyX{ int(historyIndex % m_Width) }, historyY{ int(historyIndex / m_Width) };
+		const uint32_t maxCandidates{ RESAMPLING_HISTORY_LIMIT * RESAMPLING_CANDIDATE_COUNT };
+		for (uint32_t neighbour{}; neighbour < RESAMPLING_NEIGHBOUR_COUNT; ++neighbour)
+		{
+			int neighbourX{ historyX }, neighbourY{ historyY };
+			if (neighbour > 0)
+			{
+				const uint32_t dimension{ LIGHT_SAMPLE_DIMENSION + neighbour * 2 };
+				const float angle{ m_Sampler.Get(px, py, m_ResampleFrameIndex, dimension) * 2.f * PI };
+				const float radius{ sqrtf(m_Sampler.Get(px, py, m_ResampleFrameIndex, dimension + 1)) * RESAMPLING_RADIUS };
+				neighbourX += int(roundf(cosf(angle) * radius));
+				neighbourY += int(roundf(sinf(angle) * radius));
+				if (neighbourX < 0 || neighbourY < 0 || neighbourX >= m_Width || neighbourY >= m_Height)
+					continue;
+			}
+
+			const Reservoir& history{ m_HistoryReservoirs[neighbourX + neighbourY * m_Width] };
+			if (history.nrCandidates == 0 || Vector3::Dot(history.normal, closestHit.normal) < EDGE_NORMAL_THRESHOLD ||
+				fabsf(Vector3::Dot(history.position - closestHit.origin, closestHit.normal)) > closestHit.t * REPROJECTION_DEPTH_TOLERANCE)
+				continue;
+
+			//Its kept light stands in for all the candidates it has seen
+			const uint32_t nrCandidates{ std::min(history.nrCandidates, maxCandidates) };
+			reservoir.nrCandidates += nrCandidates;
+			if (history.contributionWeight <= 0.f)
+				continue;
+
+			const float target{ getTarget(history.lightIndex) };
+			candidates[nrStored++] = { history.lightIndex, target, target * history.contributionWeight * nrCandidates };
+		}
+	}
+
+	float selectedTarget{};
+	for (uint32_t candidate{}; candidate < nrStored; ++candidate)
+	{
+		reservoir.weightSum += candidates[candidate].weight;
+	}
+	float u{ m_Sampler.Get(px, py, m_ResampleFrameIndex, LIGHT_SAMPLE_DIMENSION + 1) * reservoir.weightSum };
+	for (uint32_t candidate{}; candidate < nrStored; ++candidate)
+	{
+		const Candidate& current{ candidates[candidate] };
+		if (current.weight <= 0.f)
+			continue;
+
+		reservoir.lightIndex = current.lightIndex;
+		selectedTarget = current.target;
+		u -= current.weight;
+		if (u < 0.f)
+			break;
+	}
+
+	//Only the kept light is shadow tested, an occluded one is not passed on to the next frame
+	if (selectedTarget > 0.f)
+	{
+		reservoir.contributionWeight = reservoir.weightSum / (reservoir.nrCandidates * selectedTarget);
+		const ColorRGB contribution{ ShadeLight(scene, closestHit, lights[reservoir.lightIndex], viewRay.direction, context) };
+		if (contribution.r > 0.f || contribution.g > 0.f || contribution.b > 0.f)
+		{
+			const ColorRGB& weighted{ contribution };
+			finalColor += weighted * reservoir.contributionWeight;
+		}
+		else
+		{
+			reservoir.contributionWeight = 0.f;
+		}
+	}
+
+	if (m_SpecularFrame)
+		finalColor += ShadeSpecular(scene, closestHit, viewRay.direction, colors::White, 0, context);
+
+	stored = reservoir;
+	CountRays(context);
+	return finalColor;
+}
+
+bool Renderer::ProjectToHistory(const Vector3& position, uint32_t& historyIndex) const
+{
+	const Vector3 historyPoint{ position - m_RenderedCameraOrigin };
+	const float depth{ Vector3::Dot(historyPoint, m_RenderedCameraToWorld.GetAxisZ()) };
+	if (depth <= 0.f)
+		return false;
+
+	const float aspectRatio{ m_Width / static_cast<float>(m_Height) };
+	const float screenX{ (Vector3::Dot(historyPoint, m_RenderedCameraToWorld.GetAxisX()) / (depth * aspectRatio * m_RenderedFov) + 1.f) * .5f * m_Width };
+	const float screenY{ (1.f - Vector3::Dot(historyPoint, m_RenderedCameraToWorld.GetAxisY()) / (depth * m_RenderedFov)) * .5f * m_Height };
+	if (screenX < 0.f || screenY < 0.f || screenX >= m_Width || screenY >= m_Height)
+		return false;
+
+	historyIndex = uint32_t(screenX) + uint32_t(screenY) * m_Width;
+	return true;
+}
+
+bool Renderer::IsAntiAliasedTile(uint32_t tileIndex) const
+{
+	//Only complete first passes, accumulation takes over for the next samples
+	return m_TileRates[tileIndex] == 1 && !m_HalfTracedTiles[tileIndex] && m_TileSampleCounts[tileIndex] == 1;
+}
+
+void Renderer::DetectEdges(uint32_t tileIndex)
+{
+	if (!IsAntiAliasedTile(tileIndex))
+		return;
+
+	auto getLuminance = [](const ColorRGB& color)
+	{
+		return std::min(.2126f * color.r + .7152f * color.g + .0722f * color.b, 1.f);
+	};
+
+	auto isEdge = [&](uint32_t pixelIndex, uint32_t neighbourIndex)
+	{
+		const GBufferSample& surface{ m_GBuffer[pixelIndex] };
+		const GBufferSample& neighbour{ m_GBuffer[neighbourIndex] };
+		if ((surface.depth == FLT_MAX) != (neighbour.depth == FLT_MAX))
+			return true;
+		if (surface.depth != FLT_MAX && (surface.primitiveIndex != neighbour.primitiveIndex || surface.materialIndex != neighbour.materialIndex ||
+			Vector3::Dot(surface.normal, neighbour.normal) < EDGE_NORMAL_THRESHOLD))
+			return true;
+
+		//Shadow borders and highlights
+		return fabsf(getLuminance(m_ColorBuffer[pixelIndex]) - getLuminance(m_ColorBuffer[neighbourIndex])) > EDGE_LUMINANCE_THRESHOLD;
+	};
+
+	const int startX{ int(tileIndex % m_NrTilesX) * TILE_SIZE }, startY{ int(tileIndex / m_NrTilesX) * TILE_SIZE };
+	const int endX{ std::min(startX + TILE_SIZE, m_Width) }, endY{ std::min(startY + TILE_SIZE, m_Height) };
+
+	for (int py{ startY }; py < endY; ++py)
+	{
+		for (int px{ startX }; px < endX; ++px)
+		{
+			const uint32_t pixelIndex{ uint32_t(px + py * m_Width) };
+			m_EdgeMask[pixelIndex] =
+				(px > 0 && isEdge(pixelIndex, pixelIndex - 1)) ||
+				(px < m_Width - 1 && isEdge(pixelIndex, pixelIndex + 1)) ||
+				(py > 0 && isEdge(pixelIndex, pixelIndex - m_Width)) ||
+				(py < m_Height - 1 && isEdge(pixelIndex, pixelIndex + m_Width));
+		}
+	}
+}
+
+void Renderer::AntiAliasTile(const SceneSnapshot& scene, uint32_t tileIndex, int gridSize, const float fov, const float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin)
+{
+	if (!IsAntiAliasedTile(tileIndex))
+		return;
+
+	const uint64_t tileStart{ SDL_GetPerformanceCounter() };
+	const float strataSize{ 1.f / gridSize };
+
+	const int startX{ int(tileIndex % m_NrTilesX) * TILE_SIZE }, startY{ int(tileIndex / m_NrTilesX) * TILE_SIZE };
+	const int endX{ std::min(startX + TILE_SIZE, m_Width) }, endY{ std::min(startY + TILE_SIZE, m_Height) };
+
+	uint32_t nrRays{};
+	for (int py{ startY }; py < endY; ++py)
+	{
+		for (int px{ startX }; px < endX; ++px)
+		{
+			const uint32_t pixelIndex{ uint32_t(px + py * m_Width) };
+			if (!m_EdgeMask[pixelIndex])
+				continue;
+
+			//One sample in the centre of every stratum, an odd grid reuses the first pass sample in the middle
+			ColorRGB sum{};
+			for (int strataY{}; strataY < gridSize; ++strataY)
+			{
+				for (int strataX{}; strataX < gridSize; ++strataX)
+				{
+					if (gridSize % 2 && strataX == gridSize / 2 && strataY == gridSize / 2)
+					{
+						sum += m_ColorBuffer[pixelIndex];
+						continue;
+					}
+
+					GBufferSample surface{};
+					sum += TracePixel(scene, px + (strataX + .5f) * strataSize, py + (strataY + .5f) * strataSize, fov, aspectRatio, cameraToWorld, cameraOrigin, surface,
+						1 + strataX + strataY * gridSize);
+					++nrRays;
+				}
+			}
+
+			const ColorRGB& total{ sum };
+			m_ColorBuffer[pixelIndex] = total * (1.f / (gridSize * gridSize));
+			if (m_AccumulateFrame)
+				m_AccumulationBuffer[pixelIndex] = m_ColorBuffer[pixelIndex];
+		}
+	}
+	m_FrameRayCount += nrRays;
+	m_FrameTileTicks += SDL_GetPerformanceCounter() - tileStart;
+}
+
+void Renderer::UpsampleTile(uint32_t tileIndex)
+{
+	const int blockSize{ m_TileRates[tileIndex] };
+	if (blockSize == 1)
+		return;
+
+	const int startX{ int(tileIndex % m_NrTilesX) * TILE_SIZE }, startY{ int(tileIndex / m_NrTilesX) * TILE_SIZE };
+	const int endX{ std::min(startX + TILE_SIZE, m_Width) }, endY{ std::min(startY + TILE_SIZE, m_Height) };
+
+	for (int py{ startY }; py < endY; ++py)
+	{
+		for (int px{ startX }; px < endX; ++px)
+		{
+			//The top-left pixel holds the traced sample
+			if (px % blockSize || py % blockSize)
+				UpsamplePixel(px, py, blockSize);
+		}
+	}
+}
+
+void Renderer::UpsamplePixel(int x, int y, int blockSize)
+{
+	const uint32_t pixelIndex{ uint32_t(x + y * m_Width) };
+	const uint32_t ownIndex{ uint32_t((x - x % blockSize) + (y - y % blockSize) * m_Width) };
+	const GBufferSample ownSurface{ m_GBuffer[ownIndex] };
+
+	//Only samples that see the same surface as the own block contribute, which keeps edges from bleeding
+	auto isSimilar = [&ownSurface](const GBufferSample& surface)
+	{
+		if (ownSurface.depth == FLT_MAX || surface.depth == FLT_MAX)
+			return ownSurface.depth == surface.depth;
+		return surface.materialIndex == ownSurface.materialIndex &&
+			fabsf(surface.depth - ownSurface.depth) <= ownSurface.depth * UPSAMPLE_DEPTH_TOLERANCE;
+	};
+
+	//Bilinear between the four closest block centres
+	const float gridX{ (x + .5f) / blockSize - .5f }, gridY{ (y + .5f) / blockSize - .5f };
+	const int gridX0{ int(floorf(gridX)) }, gridY0{ int(floorf(gridY)) };
+	const float fractionX{ gridX - gridX0 }, fractionY{ gridY - gridY0 };
+
+	ColorRGB sum{};
+	float totalWeight{};
+	for (int cornerIndex{}; cornerIndex < 4; ++cornerIndex)
+	{
+		const int sampleX{ std::clamp((gridX0 + (cornerIndex & 1)) * blockSize, 0, m_Width - 1) };
+		const int sampleY{ std::clamp((gridY0 + (cornerIndex >> 1)) * blockSize, 0, m_Height - 1) };
+		const uint32_t sampleIndex{ GetSamplePixel(sampleX, sampleY) };
+		if (!isSimilar(m_GBuffer[sampleIndex]))
+			continue;
+
+		const float weight{ ((cornerIndex & 1) ? fractionX : 1.f - fractionX) * ((cornerIndex >> 1) ? fractionY : 1.f - fractionY) };
+		const ColorRGB& sampleColor{ m_ColorBuffer[sampleIndex] };
+		sum += sampleColor * weight;
+		totalWeight += weight;
+	}
+
+	m_ColorBuffer[pixelIndex] = (totalWeight > 0.f) ? sum * (1.f / totalWeight) : m_ColorBuffer[ownIndex];
+	m_GBuffer[pixelIndex] = ownSurface;
+}
+
+std::vector<uint32_t> Renderer::GetSpecularRayCounts() const
+{
+	std::vector<uint32_t> counts{};
+	for (uint32_t depth{}; depth < MAX_SPECULAR_DEPTH && m_SpecularRayCounts[depth] > 0; ++depth)
+		counts.push_back(m_SpecularRayCounts[depth]);
+	return counts;
+}
+
+uint32_t Renderer::GetSamplePixel(int x, int y) const
+{
+	//Snap to a pixel that was traced, neighbouring tiles can use another rate or be checkerboarded
+	const uint32_t tileIndex{ uint32_t(x / TILE_SIZE + (y / TILE_SIZE) * m_NrTilesX) };
+	const int blockSize{ m_TileRates[tileIndex] };
+	x -= x % blockSize;
+	y -= y % blockSize;
+
+	if (m_HalfTracedTiles[tileIndex] && ((x + y + GetTracedParity(tileIndex)) & 1))
+	{
+		if ((x ^ 1) < m_Width) x ^= 1;
+		else y ^= 1;
+	}
+
+	return uint32_t(x + y * m_Width);
+}
+
+uint32_t Renderer::GetTracedParity(uint32_t tileIndex) const
+{
+	return m_HalfTracedTiles[tileIndex] - 1u;
+}
+
+void Renderer::UpdateTileRates()
+{
+	std::lock_guard lock{ m_RateMapMutex };
+	for (int tileY{}; tileY < m_NrTilesY; ++tileY)
+	{
+		for (int tileX{}; tileX < m_NrTilesX; ++tileX)
+		{
+			const float u{ (tileX * TILE_SIZE + TILE_SIZE * .5f) / m_Width };
+			const float v{ (tileY * TILE_SIZE + TILE_SIZE * .5f) / m_Height };
+			m_TileRates[tileX + tileY * m_NrTilesX] = uint8_t(std::max(int(m_RateMap.GetRate(u, v)), m_PreviewBlockSize));
+		}
+	}
+}
+
+void Renderer::SetShadingRateMap(const ShadingRateMap& rateMap)
+{
+	std::lock_guard lock{ m_RateMapMutex };
+	m_RateMap = rateMap;
+}
+
+void Renderer::ReconstructTile(uint32_t tileIndex, const float fov, const float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin)
+{
+	//Completed tiles already hold last frame's pixels in the gaps, only changed tiles need reconstruction.
+	//Coarse and preview tiles are never half traced, upsampling already filled them.
+	if (!m_DirtyTiles[tileIndex] || !m_HalfTracedTiles[tileIndex])
+		return;
+
+	const uint32_t parity{ GetTracedParity(tileIndex) };
+
+	const int startX{ int(tileIndex % m_NrTilesX) * TILE_SIZE }, startY{ int(tileIndex / m_NrTilesX) * TILE_SIZE };
+	const int endX{ std::min(startX + TILE_SIZE, m_Width) }, endY{ std::min(startY + TILE_SIZE, m_Height) };
+
+	for (int py{ startY }; py < endY; ++py)
+	{
+		for (int px{ startX }; px < endX; ++px)
+		{
+			if ((px + py + parity) & 1)
+				ReconstructPixel(uint32_t(px + py * m_Width), fov, aspectRatio, cameraToWorld, cameraOrigin);
+		}
+	}
+}
+
+void Renderer::ReconstructPixel(uint32_t pixelIndex, const float fov, const float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin)
+{
+	const int px{ int(pixelIndex % m_Width) }, py{ int(pixelIndex / m_Width) };
+
+	//The direct neighbours were all traced this frame (or are unchanged), mirrored at the border
+	const uint32_t neighbours[4]{
+		uint32_t((px > 0 ? px - 1 : px + 1) + py * m_Width),
+		uint32_t((px < m_Width - 1 ? px + 1 : px - 1) + py * m_Width),
+		uint32_t(px + (py > 0 ? py - 1 : py + 1) * m_Width),
+		uint32_t(px + (py < m_Height - 1 ? py + 1 : py - 1) * m_Width) };
+
+	if (m_IsHistoryValid)
+	{
+		const Vector3 rayDirection{ GetViewRay(px + .5f, py + .5f, fov, aspectRatio, cameraToWorld, cameraOrigin).direction };
+
+		//Assume the gap sees the surface of one of its neighbours, reuse the previous frame's pixel if it saw the same one
+		for (const uint32_t neighbourIndex : neighbours)
+		{
+			const GBufferSample& neighbour{ m_GBuffer[neighbourIndex] };
+			if (neighbour.depth == FLT_MAX)
+				continue;
+
+			const Vector3 position{ cameraOrigin + rayDirection * neighbour.depth };
+			uint32_t historyIndex{};
+			if (!ProjectToHistory(position, historyIndex))
+				continue;
+
+			const GBufferSample& history{ m_HistoryGBuffer[historyIndex] };
+			const float distance{ (position - m_RenderedCameraOrigin).Magnitude() };
+			if (history.materialIndex != neighbour.materialIndex || fabsf(history.depth - distance) > distance * REPROJECTION_DEPTH_TOLERANCE)
+				continue;
+
+			m_ColorBuffer[pixelIndex] = m_HistoryColorBuffer[historyIndex];
+			m_GBuffer[pixelIndex] = neighbour;
+			if (m_AccumulateFrame)
+				m_AccumulationBuffer[pixelIndex] = m_ColorBuffer[pixelIndex];
+			return;
+		}
+	}
+
+	//Disoccluded or new: interpolate along the direction in which the neighbours see the most similar surface
+	auto getDifference = [](const GBufferSample& a, const GBufferSample& b)
+	{
+		if (a.depth == FLT_MAX || b.depth == FLT_MAX)
+			return (a.depth == b.depth) ? 0.f : FLT_MAX;
+		if (a.materialIndex != b.materialIndex)
+			return FLT_MAX;
+		return fabsf(a.depth - b.depth);
+	};
+
+	const bool isHorizontal{ getDifference(m_GBuffer[neighbours[0]], m_GBuffer[neighbours[1]]) <= getDifference(m_GBuffer[neighbours[2]], m_GBuffer[neighbours[3]]) };
+	const uint32_t first{ isHorizontal ? neighbours[0] : neighbours[2] }, second{ isHorizontal ? neighbours[1] : neighbours[3] };
+
+	m_ColorBuffer[pixelIndex] = ColorRGB::Lerp(m_ColorBuffer[first], m_ColorBuffer[second], .5f);
+	m_GBuffer[pixelIndex] = (m_GBuffer[first].depth <= m_GBuffer[second].depth) ? m_GBuffer[first] : m_GBuffer[second];
+	if (m_AccumulateFrame)
+		m_AccumulationBuffer[pixelIndex] = m_ColorBuffer[pixelIndex];
+}
+
+Ray Renderer::GetViewRay(float x, float y, const float fov, const float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin) const
+{
+	const float xValue{ (2.f * x / m_Width - 1.f) * aspectRatio * fov };
+	const float yValue{ (1.f - 2.f * y / m_Height) * fov };
+
+	Vector3 rayDirection{ xValue, yValue, 1.f };
+	rayDirection = cameraToWorld.TransformVector(rayDirection);
+	rayDirection.Normalize();
+
+	return { cameraOrigin, rayDirection };
+}
+
+ColorRGB Renderer::TracePixel(const SceneSnapshot& scene, float x, float y, const float fov, const float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin, GBufferSample& surface, uint32_t sampleIndex) const
+{
+	const Ray viewRay{ GetViewRay(x, y, fov, aspectRatio, cameraToWorld, cameraOrigin) };
+
+	HitRecord closestHit{};
+	scene.GetClosestHit(viewRay, closestHit);
+	if (!closestHit.didHit)
+		return {};
+
+	surface = { closestHit.t, closestHit.materialIndex, closestHit.primitiveIndex, closestHit.normal };
+	return ShadeHit(scene, closestHit, viewRay.direction, uint32_t(x), uint32_t(y), sampleIndex);
+}
+
+ColorRGB Renderer::ShadeHit(const SceneSnapshot& scene, const HitRecord& closestHit, const Vector3& rayDirection, uint32_t pixelX, uint32_t pixelY, uint32_t sampleIndex) const
+{
+	ShadingContext context{ pixelX, pixelY, sampleIndex };
+	if (m_PathTraceFrame)
+	{
+		const ColorRGB pathColor{ TracePath(scene, closestHit, rayDirection, context) };
+		CountRays(context);
+		return pathColor;
+	}
+
+	ColorRGB finalColor{ ShadeCachedDirect(scene, closestHit, rayDirection, context, true) };
+	if (m_SpecularFrame)
+		finalColor += ShadeSpecular(scene, closestHit, rayDirection, colors::White, 0, context);
+
+	CountRays(context);
+	return finalColor;
+}
+
+ColorRGB Renderer::ShadeDirect(const SceneSnapshot& scene, const HitRecord& closestHit, const Vector3& rayDirection, ShadingContext& context, bool isPrimaryHit) const
+{
+	auto& lights = scene.lights;
+	const uint32_t pixelX{ context.pixelX }, pixelY{ context.pixelY }, sampleIndex{ context.sampleIndex };
+
+	ColorRGB finalColor{ m_AoFrame ? ShadeAmbient(scene, closestHit, rayDirection, context) : ColorRGB{} };
+	if (m_CullLightsFrame)
+	{
+		//The tile's list only covers primary hits between its nearest and farthest one, anything else checks every light
+		const TileLightList& tileLights{ m_TileLightLists[pixelX / TILE_SIZE + (pixelY / TILE_SIZE) * m_NrTilesX] };
+		const float depth{ closestHit.t * Vector3::Dot(rayDirection, scene.cameraToWorld.GetAxisZ()) };
+		const bool isInTile{ isPrimaryHit && tileLights.pass == m_LightPass && depth >= tileLights.minDepth && depth <= tileLights.maxDepth };
+
+		uint32_t nrEvaluatedLights{};
+		const uint32_t nrLights{ uint32_t(isInTile ? tileLights.lights.size() : lights.size()) };
+		for (uint32_t listIndex{}; listIndex < nrLights; ++listIndex)
+		{
+			const uint32_t lightIndex{ isInTile ? tileLights.lights[listIndex] : listIndex };
+			if (!IsInLightRange(lights[lightIndex], lightIndex, closestHit.origin))
+				continue;
+
+			finalColor += ShadeLight(scene, closestHit, lights[lightIndex], rayDirection, context);
+			++nrEvaluatedLights;
+		}
+		m_FrameLightCount.fetch_add(nrEvaluatedLights, std::memory_order_relaxed);
+		return finalColor;
+	}
+
+	if (!m_SampleLightsFrame)
+	{
+		for (const Light& light : lights)
+		{
+			finalColor += ShadeLight(scene, closestHit, light, rayDirection, context);
+		}
+		m_FrameLightCount.fetch_add(lights.size(), std::memory_order_relaxed);
+		return finalColor;
+	}
+
+	for (const uint32_t lightIndex : m_LightTree.GetDirectionalLights())
+	{
+		finalColor += ShadeLight(scene, closestHit, lights[lightIndex], rayDirection, context);
+	}
+	m_FrameLightCount.fetch_add(m_LightTree.GetDirectionalLights().size() + LIGHT_SAMPLE_COUNT, std::memory_order_relaxed);
+
+	//A few point lights picked by importance, weighted by their probability
+	for (uint32_t lightSample{}; lightSample < LIGHT_SAMPLE_COUNT; ++lightSample)
+	{
+		uint32_t lightIndex{};
+		float pdf{};
+		const float u{ m_Sampler.Get(pixelX, pixelY, sampleIndex, LIGHT_SAMPLE_DIMENSION + lightSample) };
+		if (!m_LightTree.Sample(closestHit.origin, closestHit.normal, u, lightIndex, pdf))
+			break;
+
+		ColorRGB contribution{ ShadeLight(scene, closestHit, lights[lightIndex], rayDirection, context) };
+		finalColor += contribution * (1.f / (pdf * LIGHT_SAMPLE_COUNT));
+	}
+	return finalColor;
+}
+
+ColorRGB Renderer::ShadeCachedDirect(const SceneSnapshot& scene, const HitRecord& closestHit, const Vector3& rayDirection, ShadingContext& context, bool isPrimaryHit) const
+{
+	if (!m_RadianceCacheFrame || !scene.materials[closestHit.materialIndex]->IsViewIndependent())
+		return ShadeDirect(scene, closestHit, rayDirection, context, isPrimaryHit);
+
+	//Cells of a few pixels at the hit's distance. The lookup is jittered over a cell in the tangent plane,
+	//so cell borders show up as noise instead of blocks.
+	const float cellSize{ (closestHit.origin - scene.cameraOrigin).Magnitude() * m_PixelFootprint * RADIANCE_CACHE_CELL_PIXELS };
+	Vector3 tangent{}, bitangent{};
+	SamplingUtils::GetTangentFrame(closestHit.normal, tangent, bitangent);
+	const float u{ m_Sampler.Get(context.pixelX, context.pixelY, context.sampleIndex, RADIANCE_CACHE_DIMENSION) - .5f };
+	const float v{ m_Sampler.Get(context.pixelX, context.pixelY, context.sampleIndex, RADIANCE_CACHE_DIMENSION + 1) - .5f };
+	const Vector3 lookupPosition{ closestHit.origin + (tangent * u + bitangent * v) * cellSize };
+	const RadianceCache::Key key{ RadianceCache::GetKey(lookupPosition, closestHit.normal, closestHit.materialIndex, cellSize) };
+
+	m_FrameRadianceLookups.fetch_add(1, std::memory_order_relaxed);
+	ColorRGB radiance{};
+	if (m_RadianceCache.Find(key, radiance))
+	{
+		m_FrameRadianceHits.fetch_add(1, std::memory_order_relaxed);
+		return radiance;
+	}
+
+	//A miss is shaded at the hit itself and adds a sample to the cell
+	radiance = ShadeDirect(scene, closestHit, rayDirection, context, isPrimaryHit);
+	m_RadianceCache.AddSample(key, radiance);
+	return radiance;
+}
+
+ColorRGB Renderer::ShadeLight(const SceneSnapshot& scene, const HitRecord& closestHit, const Light& light, const Vector3& rayDirection, ShadingContext& context, bool isShadowTested) const
+{
+	if (light.type != LightType::Point && light.type != LightType::Directional)
+		return ShadeAreaLight(scene, closestHit, light, rayDirection, context, isShadowTested);
+
+	return ShadeLightSample(scene, closestHit, light, LightUtils::GetDirectionToLight(light, closestHit.origin), LightUtils::GetRadiance(light, closestHit.origin),
+		rayDirection, context, isShadowTested);
+}
+
+ColorRGB Renderer::ShadeAmbient(const SceneSnapshot& scene, const HitRecord& closestHit, const Vector3& rayDirection, const ShadingContext& context) const
+{
+	//Only part of the full shading, the debug modes show the direct light alone
+	if (m_LightingModeFrame != LightingMode::Combined)
+		return {};
+
+	const uint64_t aoStart{ SDL_GetPerformanceCounter() };
+
+	//Any hit within the radius occludes, consecutive sample indices keep the rays of a hit stratified
+	uint32_t nrEscaped{};
+	for (uint32_t aoSample{}; aoSample < m_AoFrameSamples; ++aoSample)
+	{
+		const uint32_t sampleIndex{ context.sampleIndex * AO_MAX_SAMPLES + aoSample };
+		const float u{ m_Sampler.Get(context.pixelX, context.pixelY, sampleIndex, AO_DIMENSION) };
+		const float v{ m_Sampler.Get(context.pixelX, context.pixelY, sampleIndex, AO_DIMENSION + 1) };
+		Ray occlusionRay{ closestHit.origin + closestHit.normal * 0.001f, SamplingUtils::SampleCosineHemisphere(closestHit.normal, u, v) };
+		occlusionRay.max = AO_RADIUS;
+		if (!scene.DoesHit(occlusionRay))
+			++nrEscaped;
+	}
+
+	//Uniform ambient light through the BRDF towards the normal, times PI for the cosine-weighted hemisphere
+	const ColorRGB brdf{ scene.materials[closestHit.materialIndex]->Shade(closestHit, closestHit.normal, -rayDirection) };
+	const ColorRGB ambient{ brdf * (AMBIENT_INTENSITY * PI * nrEscaped / m_AoFrameSamples) };
+
+	m_FrameAoRayCount.fetch_add(m_AoFrameSamples, std::memory_order_relaxed);
+	m_FrameAoTicks.fetch_add(SDL_GetPerformanceCounter() - aoStart, std::memory_order_relaxed);
+	return ambient;
+}
+
+ColorRGB Renderer::ShadeSpecular(const SceneSnapshot& scene, const HitRecord& closestHit, const Vector3& rayDirection, const ColorRGB& throughput, uint32_t depth, ShadingContext& context) const
+{
+	const Material* pMaterial{ scene.materials[closestHit.materialIndex] };
+	if (depth >= MAX_SPECULAR_DEPTH || !pMaterial->HasSpecularScatter())
+		return {};
+
+	const SpecularScatter scatter{ pMaterial->GetSpecularScatter(closestHit, rayDirection) };
+	ColorRGB finalColor{ TraceSpecularRay(scene, closestHit, Vector3::Reflect(rayDirection, closestHit.normal), scatter.reflectance, throughput, depth, 0, context) };
+	finalColor += TraceSpecularRay(scene, closestHit, scatter.transmittedDirection, scatter.transmittance, throughput, depth, 1, context);
+	return finalColor;
+}
+
+ColorRGB Renderer::TraceSpecularRay(const SceneSnapshot& scene, const HitRecord& closestHit, const Vector3& direction, const ColorRGB& weight, const ColorRGB& throughput, uint32_t depth, uint32_t branch, ShadingContext& context) const
+{
+	//Weight of the whole path up to the next hit, a dim one is continued with a probability proportional to it
+	//and weighted up when it survives, so the expected result stays the same
+	ColorRGB branchWeight{ weight };
+	const ColorRGB pathThroughput{ throughput * weight };
+	const float maxThroughput{ std::max(pathThroughput.r, std::max(pathThroughput.g, pathThroughput.b)) };
+	if (maxThroughput <= 0.f)
+		return {};
+	if (maxThroughput < SPECULAR_ROULETTE_THRESHOLD)
+	{
+		const float survival{ maxThroughput / SPECULAR_ROULETTE_THRESHOLD };
+		if (m_Sampler.Get(context.pixelX, context.pixelY, context.sampleIndex, SPECULAR_DIMENSION + depth * 2 + branch) >= survival)
+			return {};
+		branchWeight /= survival;
+	}
+
+	//Offset to the side the ray leaves on, refracted rays start inside the object
+	const Vector3 offset{ Vector3::Dot(direction, closestHit.normal) > 0.f ? closestHit.normal * 0.001f : closestHit.normal * -0.001f };
+	const Ray ray{ closestHit.origin + offset, direction };
+	++context.nrSpecularRays[depth];
+
+	HitRecord hit{};
+	scene.GetClosestHit(ray, hit);
+	if (!hit.didHit)
+		return {};
+
+	ColorRGB incoming{ ShadeCachedDirect(scene, hit, direction, context, false) };
+	incoming += ShadeSpecular(scene, hit, direction, throughput * branchWeight, depth + 1, context);
+	return incoming * branchWeight;
+}
+
+ColorRGB Renderer::TracePath(const SceneSnapshot& scene, const HitRecord& closestHit, const Vector3& rayDirection, ShadingContext& context) const
+{
+	HitRecord hit{ closestHit };
+	Vector3 direction{ rayDirection };
+	ColorRGB throughput{ colors::White };
+	ColorRGB finalColor{};
+	for (uint32_t bounce{}; ; ++bounce)
+	{
+		//Lights are never hit by the path itself, so their light is only gathered here and counted once
+		const ColorRGB& pathWeight{ throughput };
+		finalColor += pathWeight * ShadeDirect(scene, hit, direction, context, bounce == 0);
+		if (bounce >= MAX_PATH_BOUNCES)
+			break;
+
+		const uint32_t dimension{ PATH_DIMENSION + bounce * PATH_DIMENSIONS_PER_BOUNCE };
+		const float u1{ m_Sampler.Get(context.pixelX, context.pixelY, context.sampleIndex, dimension) };
+		const float u2{ m_Sampler.Get(context.pixelX, context.pixelY, context.sampleIndex, dimension + 1) };
+		const float u3{ m_Sampler.Get(context.pixelX, context.pixelY, context.sampleIndex, dimension + 2) };
+		Vector3 nextDirection{};
+		throughput *= scene.materials[hit.materialIndex]->SampleScatter(hit, direction, u1, u2, u3, nextDirection);
+
+		//Russian roulette: dim paths end early, the survivors are weighted up so the expected result stays the same
+		const float maxThroughput{ std::max(throughput.r, std::max(throughput.g, throughput.b)) };
+		if (maxThroughput <= 0.f)
+			break;
+		if (bounce >= PATH_ROULETTE_BOUNCE)
+		{
+			const float survival{ std::min(maxThroughput, PATH_MAX_SURVIVAL) };
+			if (m_Sampler.Get(context.pixelX, context.pixelY, context.sampleIndex, dimension + 3) >= survival)
+				break;
+			throughput /= survival;
+		}
+
+		//Offset to the side the ray leaves on, refracted rays start inside the object
+		const Vector3 offset{ Vector3::Dot(nextDirection, hit.normal) > 0.f ? hit.normal * 0.001f : hit.normal * -0.001f };
+		const Ray ray{ hit.origin + offset, nextDirection };
+		++context.nrPathRays;
+
+		HitRecord nextHit{};
+		scene.GetClosestHit(ray, nextHit);
+		if (!nextHit.didHit)
+			break;
+
+		hit = nextHit;
+		direction = nextDirection;
+	}
+	return finalColor;
+}
+
+void Renderer::CountRays(const ShadingContext& context) const
+{
+	m_FrameShadowRayCount.fetch_add(context.nrShadowRays, std::memory_order_relaxed);
+	m_FramePathRayCount.fetch_add(context.nrPathRays, std::memory_order_relaxed);
+	for (uint32_t depth{}; depth < MAX_SPECULAR_DEPTH && context.nrSpecularRays[depth] > 0; ++depth)
+	{
+		m_FrameSpecularRayCounts[depth].fetch_add(context.nrSpecularRays[depth], std::memory_order_relaxed);
+	}
+}
+
+ColorRGB Renderer::ShadeAreaLight(const SceneSnapshot& scene, const HitRecord& closestHit, const Light& light, const Vector3& rayDirection, ShadingContext& context, bool isShadowTested) const
+{
+	//The same jittered strata for every area light of the sample
+	const float jitterU{ m_Sampler.Get(context.pixelX, context.pixelY, context.sampleIndex, AREA_LIGHT_DIMENSION) };
+	const float jitterV{ m_Sampler.Get(context.pixelX, context.pixelY, context.sampleIndex, AREA_LIGHT_DIMENSION + 1) };
+
+	ColorRGB sum{};
+	uint32_t nrLitSamples{};
+	auto addSample = [&](uint32_t strataX, uint32_t strataY)
+	{
+		const Vector3 lightPoint{ LightUtils::SampleAreaLight(light, closestHit.origin,
+			(strataX + jitterU) / AREA_LIGHT_GRID_SIZE, (strataY + jitterV) / AREA_LIGHT_GRID_SIZE) };
+		const ColorRGB contribution{ ShadeLightSample(scene, closestHit, light, lightPoint - closestHit.origin,
+			LightUtils::GetRadiance(light, closestHit.origin, lightPoint), rayDirection, context, isShadowTested) };
+		if (contribution.r > 0.f || contribution.g > 0.f || contribution.b > 0.f)
+		{
+			sum += contribution;
+			++nrLitSamples;
+		}
+	};
+
+	for (const auto& strata : AREA_LIGHT_FIRST_STRATA)
+	{
+		addSample(strata[0], strata[1]);
+	}
+
+	//Fully lit or fully shadowed (or below the horizon) as far as the first samples can tell
+	constexpr uint32_t nrFirstSamples{ uint32_t(std::size(AREA_LIGHT_FIRST_STRATA)) };
+	const bool isPenumbra{ nrLitSamples > 0 && nrLitSamples < nrFirstSamples };
+	if (!isPenumbra || !isShadowTested || !m_ShadowsEnabled)
+	{
+		const ColorRGB& total{ sum };
+		return total * (1.f / nrFirstSamples);
+	}
+
+	for (uint32_t strataY{}; strataY < AREA_LIGHT_GRID_SIZE; ++strataY)
+	{
+		for (uint32_t strataX{}; strataX < AREA_LIGHT_GRID_SIZE; ++strataX)
+		{
+			const bool isFirst{ std::any_of(std::begin(AREA_LIGHT_FIRST_STRATA), std::end(AREA_LIGHT_FIRST_STRATA),
+				[=](const uint32_t(&strata)[2]) { return strata[0] == strataX && strata[1] == strataY; }) };
+			if (!isFirst)
+				addSample(strataX, strataY);
+		}
+	}
+
+	const ColorRGB& total{ sum };
+	return total * (1.f / (AREA_LIGHT_GRID_SIZE * AREA_LIGHT_GRID_SIZE));
+}
+
+ColorRGB Renderer::ShadeLightSample(const SceneSnapshot& scene, const HitRecord& closestHit, const Light& light, const Vector3& lightDirection, const ColorRGB& radiance, const Vector3& rayDirection, ShadingContext& context, bool isShadowTested) const
+{
+	return (this->*m_pShadeLightSample)(scene, closestHit, light, lightDirection, radiance, rayDirection, context, isShadowTested);
+}
+
+template<Renderer::LightingMode lightingMode, bool areShadowsEnabled>
+ColorRGB Renderer::ShadeLightSampleKernel(const SceneSnapshot& scene, const HitRecord& closestHit, const Light& light, const Vector3& lightDirection, const ColorRGB& radiance, const Vector3& rayDirection, ShadingContext& context, bool isShadowTested) const
+{
+	auto& materials = scene.materials;
+
+	Ray rayToLight{ closestHit.origin + closestHit.normal * 0.001f, lightDirection.Normalized() };
+	if (light.type != LightType::Directional) rayToLight.max = lightDirection.Magnitude();
+	else rayToLight.max = FLT_MAX;
+
+	// Observed area calc + early escape
+	const float observedArea{ Vector3::Dot(closestHit.normal, lightDirection) / lightDirection.Magnitude() };
+	if (observedArea <= 0.f) return {};
+
+	// Shadows
+	if constexpr (areShadowsEnabled)
+	{
+		if (isShadowTested)
+		{
+			++context.nrShadowRays;
+			if (scene.DoesHit(rayToLight)) return {};
+		}
+	}
+
+	if constexpr (lightingMode == LightingMode::ObservedArea)
+		return { observedArea, observedArea, observedArea };
+	else if constexpr (lightingMode == LightingMode::Radience)
+		return radiance;
+	else if constexpr (lightingMode == LightingMode::BRDF)
+		return materials[closestHit.materialIndex]->Shade(closestHit, rayToLight.direction, -rayDirection);
+	else
+		return radiance *
+			materials[closestHit.materialIndex]->Shade(closestHit, rayToLight.direction, -rayDirection) *
+			observedArea;
+}
+
+Renderer::ShadeLightSampleFunction Renderer::GetShadeLightSampleKernel(LightingMode lightingMode, bool areShadowsEnabled)
+{
+	//Path tracing gathers its direct light like the combined mode
+	switch (lightingMode)
+	{
+	case LightingMode::ObservedArea:
+		return areShadowsEnabled ? &Renderer::ShadeLightSampleKernel<LightingMode::ObservedArea, true> : &Renderer::ShadeLightSampleKernel<LightingMode::ObservedArea, false>;
+	case LightingMode::Radience:
+		return areShadowsEnabled ? &Renderer::ShadeLightSampleKernel<LightingMode::Radience, true> : &Renderer::ShadeLightSampleKernel<LightingMode::Radience, false>;
+	case LightingMode::BRDF:
+		return areShadowsEnabled ? &Renderer::ShadeLightSampleKernel<LightingMode::BRDF, true> : &Renderer::ShadeLightSampleKernel<LightingMode::BRDF, false>;
+	default:
+		return areShadowsEnabled ? &Renderer::ShadeLightSampleKernel<LightingMode::Combined, true> : &Renderer::ShadeLightSampleKernel<LightingMode::Combined, false>;
+	}
+}
+
+void Renderer::UpdateLights(const SceneSnapshot& scene)
+{
+	if (!m_IsLightTreeValid || scene.versions.lights != m_LightTreeVersion || scene.lights.size() != m_NrTreeLights)
+	{
+		m_LightTree.Build(scene.lights);
+		m_LightTreeVersion = scene.versions.lights;
+		m_NrTreeLights = scene.lights.size();
+		m_IsLightTreeValid = true;
+	}
+
+	m_SampleLightsFrame = !m_ExhaustiveLighting && m_LightTree.GetPointLightCount() >= MIN_SAMPLED_LIGHT_COUNT;
+
+	//Resampling takes over the primary hits, extra anti-aliasing samples still go through the tree.
+	//Only worth its candidates with as many lights as the tree needs.
+	m_ResampleLightsFrame = m_ResampledLighting && m_SampleLightsFrame && !m_PathTraceFrame;
+	m_IsResamplingLights = m_ResampleLightsFrame;
+
+	//Culling takes over from the light tree, the tile lists are evaluated exhaustively
+	const float radianceCutoff{ m_RadianceCutoff };
+	m_CullLightsFrame = radianceCutoff > 0.f && !m_ResampleLightsFrame;
+	m_SampleLightsFrame = m_SampleLightsFrame && !m_CullLightsFrame;
+	m_IsSamplingLights = m_SampleLightsFrame;
+
+	//Lists of earlier passes can belong to another camera or other lights
+	++m_LightPass;
+	if (!m_CullLightsFrame)
+		return;
+
+	//Color * intensity / distance^2 stays below the cutoff in every channel beyond the radius, measured from the
+	//surface of area lights
+	m_LightRadii.resize(scene.lights.size());
+	for (size_t lightIndex{}; lightIndex < scene.lights.size(); ++lightIndex)
+	{
+		const Light& light{ scene.lights[lightIndex] };
+		const float maxChannel{ std::max(light.color.r, std::max(light.color.g, light.color.b)) };
+		m_LightRadii[lightIndex] = light.type != LightType::Directional ?
+			sqrtf(std::max(light.intensity * maxChannel, 0.f) / radianceCutoff) + LightUtils::GetExtent(light) : FLT_MAX;
+	}
+	m_TileLightLists.resize(size_t(m_NrTilesX) * m_NrTilesY);
+}
+
+bool Renderer::IsInLightRange(const Light& light, uint32_t lightIndex, const Vector3& position) const
+{
+	if (light.type == LightType::Directional)
+		return true;
+
+	const float radius{ m_LightRadii[lightIndex] };
+	return (light.origin - position).SqrMagnitude() <= radius * radius;
+}
+
+void Renderer::CullTileLights(const SceneSnapshot& scene, uint32_t tileIndex, const float fov, const float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin)
+{
+	const int blockSize{ m_TileRates[tileIndex] };
+	const int startX{ int(tileIndex % m_NrTilesX) * TILE_SIZE }, startY{ int(tileIndex / m_NrTilesX) * TILE_SIZE };
+	const int endX{ std::min(startX + TILE_SIZE, m_Width) }, endY{ std::min(startY + TILE_SIZE, m_Height) };
+	const Vector3 forward{ cameraToWorld.GetAxisZ() };
+
+	//Depth range of the hits the G-buffer still holds from the tile's last render, so no rays are traced twice.
+	//The list is right for any range, hits outside it (moved camera or geometry, jittered samples) fall back to all lights.
+	TileLightList& tileLights{ m_TileLightLists[tileIndex] };
+	tileLights.pass = m_LightPass;
+	tileLights.minDepth = FLT_MAX;
+	tileLights.maxDepth = -FLT_MAX;
+	tileLights.lights.clear();
+	for (int py{ startY }; py < endY; py += blockSize)
+	{
+		for (int px{ startX }; px < endX; px += blockSize)
+		{
+			const float distance{ m_GBuffer[px + py * m_Width].depth };
+			if (distance == FLT_MAX)
+				continue;
+
+			const Ray viewRay{ GetViewRay(px + .5f * blockSize, py + .5f * blockSize, fov, aspectRatio, cameraToWorld, cameraOrigin) };
+			const float depth{ distance * Vector3::Dot(viewRay.direction, forward) };
+			tileLights.minDepth = std::min(tileLights.minDepth, depth);
+			tileLights.maxDepth = std::max(tileLights.maxDepth, depth);
+		}
+	}
+	if (tileLights.minDepth > tileLights.maxDepth)
+		return;
+
+	//Side planes of the tile frustum in camera space, through the camera and the tile borders, pointing inwards
+	const float leftSlope{ (2.f * startX / m_Width - 1.f) * aspectRatio * fov };
+	const float rightSlope{ (2.f * endX / m_Width - 1.f) * aspectRatio * fov };
+	const float topSlope{ (1.f - 2.f * startY / m_Height) * fov };
+	const float bottomSlope{ (1.f - 2.f * endY / m_Height) * fov };
+	const Vector3 planes[4]{
+		Vector3{ 1.f, 0.f, -leftSlope }.Normalized(),
+		Vector3{ -1.f, 0.f, rightSlope }.Normalized(),
+		Vector3{ 0.f, -1.f, topSlope }.Normalized(),
+		Vector3{ 0.f, 1.f, -bottomSlope }.Normalized() };
+
+	const Vector3 right{ cameraToWorld.GetAxisX() }, up{ cameraToWorld.GetAxisY() };
+	for (uint32_t lightIndex{}; lightIndex < scene.lights.size(); ++lightIndex)
+	{
+		const Light& light{ scene.lights[lightIndex] };
+		if (light.type == LightType::Directional)
+		{
+			tileLights.lights.push_back(lightIndex);
+			continue;
+		}
+
+		//Sphere against the depth range and the side planes, conservative near the frustum corners
+		const float radius{ m_LightRadii[lightIndex] };
+		const Vector3 toLight{ light.origin - cameraOrigin };
+		const Vector3 lightPosition{ Vector3::Dot(toLight, right), Vector3::Dot(toLight, up), Vector3::Dot(toLight, forward) };
+		bool isInside{ lightPosition.z >= tileLights.minDepth - radius && lightPosition.z <= tileLights.maxDepth + radius };
+		for (int planeIndex{}; isInside && planeIndex < 4; ++planeIndex)
+		{
+			isInside = Vector3::Dot(planes[planeIndex], lightPosition) >= -radius;
+		}
+
+		if (isInside)
+			tileLights.lights.push_back(lightIndex);
+	}
+}
+
+bool Renderer::Present(uint32_t timeoutMs, uint64_t& inputTimestamp)
+{
+	{
+		std::unique_lock lock{ m_FrameMutex };
+		if (!m_FrameCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return m_HasNewFrame; }))
+			return false;
+
+		std::swap(m_ReadyIndex, m_DisplayIndex);
+		m_HasNewFrame = false;
+	}
+
+	//The display buffer is only touched by the main thread, so the copy can happen outside the lock
+	SDL_LockSurface(m_pBuffer);
+	const std::vector<uint32_t>& frameBuffer{ m_FrameBuffers[m_DisplayIndex] };
+	for (int row{}; row < m_WindowHeight; ++row)
+	{
+		memcpy(static_cast<uint8_t*>(m_pBuffer->pixels) + size_t(row) * m_pBuffer->pitch,
+			frameBuffer.data() + size_t(row) * m_WindowWidth, size_t(m_WindowWidth) * sizeof(uint32_t));
+	}
+	SDL_UnlockSurface(m_pBuffer);
+
+	//Update SDL Surface
+	SDL_UpdateWindowSurface(m_pWindow);
+
+	inputTimestamp = m_FrameTimestamps[m_DisplayIndex];
+	return true;
+}
+
+bool Renderer::SaveBufferToImage() const
+{
+	return SDL_SaveBMP(m_pBuffer, "RayTracing_Buffer.bmp");
+}
+
+void Renderer::CycleAntiAliasing()
+{
+	//1, 4, 9, 16 samples
+	const uint32_t gridSize{ uint32_t(sqrtf(float(m_AntiAliasingSamples))) + 1 };
+	m_AntiAliasingSamples = (gridSize * gridSize > MAX_ANTI_ALIASING_SAMPLES) ? 1 : gridSize * gridSize;
+	++m_SettingsVersion;
+}
+
+void Renderer::CycleToneMapping()
+{
+	m_CurrentToneMapping = static_cast<ToneMapping>((int(m_CurrentToneMapping.load()) + 1) % 3);
+	++m_PostVersion;
+}
+
+void Renderer::CycleSampler()
+{
+	m_RequestedSampler = static_cast<SamplerType>((int(m_RequestedSampler.load()) + 1) % 3);
+	++m_SettingsVersion;
+}
+
+void Renderer::RunConvergenceBenchmark(const SceneSnapshot& scene, uint32_t maxSamples)
+{
+	const Matrix& cameraToWorld{ scene.cameraToWorld };
+	const float aspectRatio = m_Width / static_cast<float>(m_Height);
+	const float FOV = tanf((scene.fovAngle * TO_RADIANS) / 2);
+	const size_t nrPixels{ size_t(m_Width) * m_Height };
+	UpdateLights(scene);
+
+	//Adds samples [firstSample, lastSample) of every pixel to its sum, the benchmarked sampler places them in the pixel
+	auto addSamples = [&](const Sampler& sampler, uint32_t firstSample, uint32_t lastSample, std::vector<ColorRGB>& sums)
+	{
+		auto addRow = [&](uint32_t row)
+		{
+			for (int x{}; x < m_Width; ++x)
+			{
+				for (uint32_t sampleIndex{ firstSample }; sampleIndex < lastSample; ++sampleIndex)
+				{
+					GBufferSample surface{};
+					sums[x + row * m_Width] += TracePixel(scene, x + sampler.Get(x, row, sampleIndex, 0), row + sampler.Get(x, row, sampleIndex, 1),
+						FOV, aspectRatio, cameraToWorld, scene.cameraOrigin, surface, sampleIndex);
+				}
+			}
+		};
+#if defined(PARALLEL_EXECUTION)
+		std::for_each(std::execution::par, m_OutputRows.begin(), m_OutputRows.begin() + m_Height, addRow);
+#else
+		std::for_each(m_OutputRows.begin(), m_OutputRows.begin() + m_Height, addRow);
+#endif
+	};
+
+	//Compared as displayed, brighter than one is scaled down
+	auto getDisplayColor = [](const ColorRGB& sum, uint32_t nrSamples)
+	{
+		ColorRGB color{ sum * (1.f / nrSamples) };
+		color.MaxToOne();
+		return color;
+	};
+
+	//Differently seeded, so the reference does not share its error with the Sobol sampler under test
+	const uint32_t nrReferenceSamples{ maxSamples * 4 };
+	std::vector<ColorRGB> reference(nrPixels);
+	{
+		const Sampler referenceSampler{ SamplerType::Sobol, 1 };
+		addSamples(referenceSampler, 0, nrReferenceSamples, reference);
+		for (ColorRGB& color : reference)
+			color = getDisplayColor(color, nrReferenceSamples);
+	}
+
+	std::ofstream fileStream("convergence.txt");
+	fileStream << "REFERENCE = " << nrReferenceSamples << " samples" << std::endl;
+	std::cout << ">> CONVERGENCE (RMSE, reference " << nrReferenceSamples << " samples)" << std::endl;
+
+	for (const SamplerType type : { SamplerType::Pcg, SamplerType::Sobol, SamplerType::BlueNoise })
+	{
+		const Sampler sampler{ type };
+		std::vector<ColorRGB> sums(nrPixels);
+		uint32_t nrSamples{};
+		for (uint32_t targetSamples{ 1 }; targetSamples <= maxSamples; targetSamples *= 2)
+		{
+			addSamples(sampler, nrSamples, targetSamples, sums);
+			nrSamples = targetSamples;
+
+			double squaredError{};
+			for (size_t pixelIndex{}; pixelIndex < nrPixels; ++pixelIndex)
+			{
+				const ColorRGB color{ getDisplayColor(sums[pixelIndex], nrSamples) };
+				const ColorRGB& expected{ reference[pixelIndex] };
+				squaredError += Square(color.r - expected.r) + Square(color.g - expected.g) + Square(color.b - expected.b);
+			}
+			const double error{ sqrt(squaredError / (3.0 * nrPixels)) };
+
+			fileStream << Sampler::GetName(type) << " " << nrSamples << " = " << error << std::endl;
+			std::cout << ">> " << Sampler::GetName(type) << " " << nrSamples << " spp = " << error << std::endl;
+		}
+	}
+}
+
+void Renderer::SetWorkerPool(WorkerPool* pWorkerPool)
+{
+	m_pWorkerPool = pWorkerPool;
+	m_NodeScenes.clear();
+	m_AreNodeScenesValid = false;
+	if (!m_pWorkerPool || m_pWorkerPool->GetNodeCount() == 1)
+		return;
+
+	m_NodeScenes.resize(m_pWorkerPool->GetNodeCount());
+	DistributeRows(m_ColorBuffer);
+	DistributeRows(m_GBuffer);
+	DistributeRows(m_AccumulationBuffer);
+
+	//The redistributed buffers start out empty
+	m_HasRendered = false;
+}
+
+int Renderer::GetTileNode(uint32_t tileIndex) const
+{
+	//Bands of tile rows, the same split as the framebuffer rows in DistributeRows
+	return int(tileIndex / m_NrTilesX) * m_pWorkerPool->GetNodeCount() / m_NrTilesY;
+}
+
+void Renderer::UpdateNodeScenes(const SceneSnapshot& scene)
+{
+	//Geometry, lights and materials only when they changed, copying them every frame would double the capture cost.
+	//Materials are shared objects, only the pointers are copied.
+	auto hasSameContent = [&scene](const SceneSnapshot& nodeScene)
+	{
+		SceneVersions versions{ scene.versions };
+		versions.camera = nodeScene.versions.camera;
+		if (versions != nodeScene.versions || scene.triangleMeshGeometries.size() != nodeScene.triangleMeshGeometries.size())
+			return false;
+
+		for (size_t meshIndex{}; meshIndex < scene.triangleMeshGeometries.size(); ++meshIndex)
+		{
+			if (scene.triangleMeshGeometries[meshIndex].version != nodeScene.triangleMeshGeometries[meshIndex].version)
+				return false;
+		}
+		return true;
+	};
+
+	//Copied by a worker of the node itself, so the first touch places the pages there
+	m_pWorkerPool->RunOnEachNode([&](int node)
+		{
+			SceneSnapshot& nodeScene{ m_NodeScenes[node] };
+			if (!m_AreNodeScenesValid || !hasSameContent(nodeScene))
+			{
+				nodeScene = scene;
+				return;
+			}
+
+			nodeScene.cameraOrigin = scene.cameraOrigin;
+			nodeScene.cameraToWorld = scene.cameraToWorld;
+			nodeScene.fovAngle = scene.fovAngle;
+			nodeScene.versions.camera = scene.versions.camera;
+		});
+	m_AreNodeScenesValid = true;
+}
+
+template<typename T>
+void Renderer::DistributeRows(std::vector<T>& buffer)
+{
+#if defined(__linux__)
+	//Dropped pages read back as zero and get allocated again on the node of the first thread writing them
+	const uintptr_t pageSize{ uintptr_t(sysconf(_SC_PAGESIZE)) };
+	const uintptr_t begin{ (uintptr_t(buffer.data()) + pageSize - 1) & ~(pageSize - 1) };
+	const uintptr_t end{ uintptr_t(buffer.data() + buffer.size()) & ~(pageSize - 1) };
+	if (end > begin)
+		madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+#endif
+
+	//Without first-touch placement (Windows) this only resets the buffer
+	const int nrNodes{ m_pWorkerPool->GetNodeCount() };
+	const int nrTileRows{ (m_WindowHeight + TILE_SIZE - 1) / TILE_SIZE };
+	m_pWorkerPool->ForEach(uint32_t(m_WindowHeight),
+		[&](uint32_t row) { return int(row) / TILE_SIZE * nrNodes / nrTileRows; },
+		[&](uint32_t row, int) { std::fill_n(buffer.begin() + size_t(row) * m_WindowWidth, m_WindowWidth, T{}); },
+		false);
+}
+
+void Renderer::RunScalingBenchmark(const SceneSnapshot& scene)
+{
+	WorkerPool* pPreviousWorkerPool{ m_pWorkerPool };
+	const std::vector<LogicalCpu> cpus{ CpuTopology::Detect().GetWorkerCpus(true) };
+
+	std::vector<int> workerCounts{};
+	for (int nrWorkers{ 1 }; nrWorkers < int(cpus.size()); nrWorkers *= 2)
+		workerCounts.push_back(nrWorkers);
+	workerCounts.push_back(int(cpus.size()));
+
+	//Timed frames trace every pixel once: no checkerboard halves, previews, deadline cuts or accumulated samples
+	const bool wasCheckerboard{ m_CheckerboardEnabled }, wasProgressive{ m_ProgressiveEnabled }, wasBudgeted{ m_BudgetEnabled }, wasAccumulating{ m_AccumulationEnabled };
+	m_CheckerboardEnabled = false;
+	m_ProgressiveEnabled = false;
+	m_BudgetEnabled = false;
+	m_AccumulationEnabled = false;
+
+	std::ofstream fileStream("scaling.txt");
+	std::cout << ">> SCALING (tile trace time, best of " << SCALING_REPETITIONS << " full frames)" << std::endl;
+
+	float singleWorkerTime{};
+	for (const int nrWorkers : workerCounts)
+	{
+		WorkerPool workerPool{ std::vector<LogicalCpu>(cpus.begin(), cpus.begin() + nrWorkers) };
+		SetWorkerPool(&workerPool);
+
+		float bestTime{ FLT_MAX };
+		for (int repetition{}; repetition < SCALING_REPETITIONS; ++repetition)
+		{
+			m_HasRendered = false;
+			Render(scene);
+			bestTime = std::min(bestTime, m_TraceTime.load());
+		}
+		if (nrWorkers == 1)
+			singleWorkerTime = bestTime;
+
+		const float speedup{ singleWorkerTime / bestTime };
+		fileStream << "WORKERS " << nrWorkers << " = " << bestTime * 1000.f << " ms, speedup " << speedup << ", efficiency " << speedup / nrWorkers << std::endl;
+		std::cout << ">> " << nrWorkers << " workers (" << workerPool.GetNodeCount() << " nodes) = " << bestTime * 1000.f
+			<< " ms, speedup " << speedup << ", efficiency " << speedup / nrWorkers << std::endl;
+	}
+
+	SetWorkerPool(pPreviousWorkerPool);
+	m_CheckerboardEnabled = wasCheckerboard;
+	m_ProgressiveEnabled = wasProgressive;
+	m_BudgetEnabled = wasBudgeted;
+	m_AccumulationEnabled = wasAccumulating;
+	m_HasRendered = false;
 }
 
 void Renderer::CycleLightingMode()
 {
-	m_CurrentLightingMode = static_cast<LightingMode>((int(m_CurrentLightingMode)+1) % 4);
+	m_CurrentLightingMode = static_cast<LightingMode>((int(m_CurrentLightingMode.load())+1) % 5);
+	++m_SettingsVersion;
 }
\ No newline at end of file
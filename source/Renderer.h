@@ -1,14 +1,65 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
-#include "Matrix.h"
+#include <mutex>
+#include <vector>
+#include "LightTree.h"
+#include "Math.h"
+#include "RadianceCache.h"
+#include "Sampler.h"
+#include "Scene.h"
 
 struct SDL_Window;
 struct SDL_Surface;
 
 namespace dae
 {
-	class Scene;
+	class WorkerPool;
+
+	//Primary hit of a pixel, used to validate reused samples
+	struct GBufferSample
+	{
+		float depth{ FLT_MAX };
+		unsigned char materialIndex{};
+		uint32_t primitiveIndex{};
+		Vector3 normal{};
+	};
+
+	//Layout of the window surface, detected once. Packed 8 bit channels are written directly, anything else goes through SDL_MapRGB.
+	struct OutputFormat
+	{
+		bool isPacked{ false };
+		uint32_t redShift{};
+		uint32_t greenShift{};
+		uint32_t blueShift{};
+		uint32_t alphaMask{};
+	};
+
+	//Rays per block of pixels: 1x1 is full rate, coarser blocks trace one ray and upsample the rest
+	enum class ShadingRate : uint8_t
+	{
+		Rate1x1 = 1,
+		Rate2x2 = 2,
+		Rate4x4 = 4
+	};
+
+	//Shading rates over the whole screen, independent of the render resolution. An empty map is full rate everywhere.
+	struct ShadingRateMap
+	{
+		int width{};
+		int height{};
+		std::vector<ShadingRate> rates{};
+
+		//u and v in [0, 1]
+		ShadingRate GetRate(float u, float v) const;
+
+		//Full rate within innerRadius of the focus point, 2x2 up to outerRadius and 4x4 beyond.
+		//Focus in [0, 1] screen coordinates, radii relative to the map height.
+		static ShadingRateMap CreateFoveated(int width, int height, float focusX, float focusY, float innerRadius, float outerRadius);
+	};
 
 	class Renderer final
 	{
@@ -21,12 +72,144 @@ namespace dae
 		Renderer& operator=(const Renderer&) = delete;
 		Renderer& operator=(Renderer&&) noexcept = delete;
 
-		void Render(Scene* pScene) const;
-		void RenderPixel(Scene* pScene, const uint32_t pixelIndex, const float fov, const float aspectRatio, const Matrix cameraToWorld, const Vector3 cameraOrigin) const;
+		//Render thread: traces into the back buffer and hands it over as the latest completed frame.
+		//Returns false when nothing changed and there was nothing left to accumulate, no frame is traced then.
+		//A re-exposed copy of the last frame can still be handed over when only the post stage changed.
+		bool Render(const SceneSnapshot& scene, uint64_t inputTimestamp = 0);
+		void RenderTile(const SceneSnapshot& scene, const uint32_t tileIndex, const float fov, const float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin);
+		//Returns true when the shading was reused from the temporal cache
+		bool RenderPixel(const SceneSnapshot& scene, const uint32_t pixelIndex, const float fov, const float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin, const uint32_t sampleCount, const int blockSize = 1);
+		//sampleIndex picks the random numbers of the stochastic light selection
+		ColorRGB TracePixel(const SceneSnapshot& scene, float x, float y, const float fov, const float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin, GBufferSample& surface, uint32_t sampleIndex = 0) const;
+		ColorRGB ShadeHit(const SceneSnapshot& scene, const HitRecord& closestHit, const Vector3& rayDirection, uint32_t pixelX, uint32_t pixelY, uint32_t sampleIndex) const;
+
+		//Main thread: waits at most timeoutMs for a completed frame and copies it to the window surface
+		bool Present(uint32_t timeoutMs, uint64_t& inputTimestamp);
 		bool SaveBufferToImage() const;
 
 		void CycleLightingMode();
-		void ToggleShadows() { m_ShadowsEnabled = !m_ShadowsEnabled; };
+		void ToggleShadows() { m_ShadowsEnabled = !m_ShadowsEnabled; ++m_SettingsVersion; };
+		//Many point lights are sampled through the light tree, the exhaustive mode evaluates all of them as a reference
+		void ToggleExhaustiveLighting() { m_ExhaustiveLighting = !m_ExhaustiveLighting; ++m_SettingsVersion; };
+		bool IsSamplingLights() const { return m_IsSamplingLights; }
+		//Reservoir resampling (ReSTIR): every pixel streams candidate lights from the light tree into a reservoir, reuses the
+		//reservoirs of the previous frame around its reprojection and casts a single shadow ray to the light it kept.
+		//Like the light tree only with enough point lights.
+		void ToggleResampledLighting() { m_ResampledLighting = !m_ResampledLighting; ++m_SettingsVersion; };
+		bool IsResamplingLights() const { return m_IsResamplingLights; }
+		//Point lights are ignored where their radiance drops below the cutoff, 0 disables the culling.
+		//Every tile then shades with the lights that reach its depth-bounded frustum only.
+		void SetRadianceCutoff(float cutoff) { m_RadianceCutoff = cutoff; ++m_SettingsVersion; }
+		float GetRadianceCutoff() const { return m_RadianceCutoff; }
+		//Lights shaded per traced ray in the last frame
+		float GetLightsPerPixel() const { return m_LightsPerPixel; }
+		//Shadow rays per shaded light in the last frame, area lights add more where their samples disagree
+		float GetShadowRaysPerLight() const { return m_ShadowRaysPerLight; }
+		//Ambient occlusion: ambient light scaled by the fraction of short cosine-weighted rays around the hit that escape.
+		//The rays per hit adapt to a share of the frame budget, the temporal cache keeps the result for static geometry.
+		void ToggleAmbientOcclusion() { m_AmbientOcclusionEnabled = !m_AmbientOcclusionEnabled; ++m_SettingsVersion; };
+		bool IsAmbientOcclusionEnabled() const { return m_AmbientOcclusionEnabled; }
+		uint32_t GetAmbientOcclusionSamples() const { return m_AoSampleCount; }
+		//Estimated share of the last frame's tracing time spent on occlusion rays
+		float GetAmbientOcclusionTime() const { return m_AoTime; }
+		//Mirror reflection and refraction of materials with specular parts, traced as secondary rays up to a fixed depth.
+		//Branches carrying little light survive with a probability proportional to their throughput (Russian roulette).
+		void ToggleSpecularRays() { m_SpecularEnabled = !m_SpecularEnabled; ++m_SettingsVersion; };
+		bool IsTracingSpecular() const { return m_IsTracingSpecular; }
+		//Secondary rays per depth in the last frame (0 leaves the primary hit), up to the deepest one traced
+		std::vector<uint32_t> GetSpecularRayCounts() const;
+		//Path tracing lighting mode: primary samples per second of tracing and rays per sample (bounces, shadow rays not included)
+		bool IsPathTracing() const { return m_IsPathTracing; }
+		float GetPathSamplesPerSecond() const { return m_PathSamplesPerSecond; }
+		float GetPathRaysPerSample() const { return m_PathRaysPerSample; }
+		void ToggleAccumulation() { m_AccumulationEnabled = !m_AccumulationEnabled; ++m_SettingsVersion; };
+		void ToggleIncrementalRendering() { m_IncrementalEnabled = !m_IncrementalEnabled; ++m_SettingsVersion; };
+		void ToggleTileOverlay() { m_ShowTileOverlay = !m_ShowTileOverlay; };
+		//Coarse-to-fine preview while the camera moves, refined within the frame budget (seconds)
+		void ToggleProgressivePreview() { m_ProgressiveEnabled = !m_ProgressiveEnabled; };
+		void SetFrameBudget(float seconds) { m_FrameBudget = seconds; }
+		//Hard budget: tracing stops at the deadline, the tiles left over keep their previous or coarse colors
+		//and are traced first in the next frame
+		void ToggleBudgetedRendering() { m_BudgetEnabled = !m_BudgetEnabled; };
+		bool IsBudgeted() const { return m_BudgetEnabled; }
+		//Fraction of the budgeted frames that finished within the budget, since budgeting was enabled
+		float GetDeadlineHitRate() const { return m_DeadlineHitRate; }
+		//Fraction of the tiles to trace in the last rendered frame that made the deadline
+		float GetTileCompletion() const { return m_TileCompletion; }
+
+		//Main thread, applied from the next rendered frame on, tiles whose rate changes are re-rendered
+		void SetShadingRateMap(const ShadingRateMap& rateMap);
+		//Samples for pixels on geometry or color edges, in a stratified grid (1 disables anti-aliasing)
+		void CycleAntiAliasing();
+		uint32_t GetAntiAliasingSamples() const { return m_AntiAliasingSamples; }
+		//Temporal cache: reuse the previous frame's shading of the same surface point for at most maxAge frames
+		void ToggleTemporalCache() { m_CacheEnabled = !m_CacheEnabled; ++m_SettingsVersion; };
+		void SetCacheMaxAge(uint32_t maxAge) { m_CacheMaxAge = maxAge; }
+		bool IsCaching() const { return m_CacheEnabled; }
+		//Fraction of the rays of the last frame that reused cached shading
+		float GetCacheHitRate() const { return m_CacheHitRate; }
+		//Radiance cache: the direct light of view independent surfaces is kept per world-space cell and reused by every pixel
+		//and frame that looks it up, also while the camera moves. Changed lights clear it, moving meshes evict what they may shadow.
+		void ToggleRadianceCache() { m_RadianceCacheEnabled = !m_RadianceCacheEnabled; ++m_SettingsVersion; };
+		bool IsRadianceCaching() const { return m_RadianceCacheEnabled; }
+		//Fraction of the lookups in the last frame that found the light, the filled entries and the bytes of the table
+		float GetRadianceCacheHitRate() const { return m_RadianceCacheHitRate; }
+		uint32_t GetRadianceCacheEntryCount() const { return m_RadianceCache.GetEntryCount(); }
+		size_t GetRadianceCacheMemory() const { return m_RadianceCache.GetMemorySize(); }
+		//Entries removed for changes in the last frame and the time it took
+		uint32_t GetRadianceCacheEvictCount() const { return m_RadianceEvictCount; }
+		float GetRadianceCacheEvictTime() const { return m_RadianceEvictTime; }
+
+		void ToggleCheckerboard() { m_CheckerboardEnabled = !m_CheckerboardEnabled; ++m_SettingsVersion; };
+
+		//Per-axis scale of the internal render resolution, picked up at the start of the next frame
+		void SetRenderScale(float scale) { m_RequestedScale = scale; }
+		float GetRenderScale() const { return m_RequestedScale; }
+
+		bool IsAccumulating() const { return m_AccumulationEnabled; }
+		uint32_t GetSampleCount() const { return m_SampleCount; }
+		//Random numbers of the jittered accumulation samples
+		void CycleSampler();
+		const char* GetSamplerName() const { return Sampler::GetName(m_RequestedSampler); }
+
+		//Render thread: renders the scene with 1 to maxSamples jittered samples per pixel for every sampler
+		//and writes the RMSE against a high sample count reference to convergence.txt
+		void RunConvergenceBenchmark(const SceneSnapshot& scene, uint32_t maxSamples = 64);
+
+		//Trace the tiles on pinned workers instead of std::execution::par, nullptr switches back. Set it before the
+		//render thread starts or from the render thread. With several NUMA nodes the framebuffer rows and a copy of
+		//the scene are placed on every node, and tiles go to the node holding their rows first.
+		void SetWorkerPool(WorkerPool* pWorkerPool);
+		//Render thread: traces full frames with 1 to N physical cores and writes the speedup to scaling.txt
+		void RunScalingBenchmark(const SceneSnapshot& scene);
+		uint32_t GetRenderedTileCount() const { return m_RenderedTileCount; }
+		uint32_t GetTileCount() const { return m_NrTilesX * m_NrTilesY; }
+		bool IsCheckerboarding() const { return m_CheckerboardEnabled; }
+
+		uint32_t GetTracedRayCount() const { return m_TracedRayCount; }
+		//Rays per pixel of the tiles rendered in the last frame
+		float GetSamplesPerPixel() const { return m_SamplesPerPixel; }
+
+		//Duration of the last rendered frame in seconds: tracing the tiles and filling in the untraced pixels
+		float GetTraceTime() const { return m_TraceTime; }
+		float GetReconstructTime() const { return m_ReconstructTime; }
+
+		//Post stage: exposure and tone mapping of the float image, changes only re-run the output stage and never re-trace
+		void CycleToneMapping();
+		void ToggleAutoExposure() { m_AutoExposureEnabled = !m_AutoExposureEnabled; ++m_PostVersion; };
+		//Manual exposure in stops, on top of the auto-exposure when that is enabled
+		void AdjustExposure(float stops) { m_ExposureCompensation = m_ExposureCompensation + stops; ++m_PostVersion; };
+		bool IsAutoExposing() const { return m_AutoExposureEnabled; }
+		//Linear scale applied to the last handed over frame
+		float GetExposure() const { return m_Exposure; }
+		//Luminance histogram, exposure and tone mapping of the frames handed over in the last rendered frame
+		float GetPostTime() const { return m_PostTime; }
+		//Edge-avoiding a-trous filter in the post stage, guided by the normal, depth and albedo of the primary hits.
+		//Only the output is filtered, the traced and accumulated colors stay as they are.
+		void ToggleDenoiser() { m_DenoiserEnabled = !m_DenoiserEnabled; ++m_PostVersion; };
+		bool IsDenoising() const { return m_DenoiserEnabled; }
+		//Part of the post time of the last handed over frame
+		float GetDenoiseTime() const { return m_DenoiseTime; }
 
 	private:
 		enum class LightingMode
@@ -34,18 +217,438 @@ namespace dae
 			ObservedArea, //Lambert Cosine Law
 			Radience, //Incident Radiance
 			BRDF, //Scattering of the light
-			Combined //ObservedArea*Radience*BRDF
+			Combined, //ObservedArea*Radience*BRDF
+			PathTraced //Combined at every vertex of a path (next-event estimation), accumulated over the frames
+		};
+
+		enum class ToneMapping
+		{
+			Clamp, //Scale colors brighter than one back down (MaxToOne)
+			Reinhard, //c / (1 + c)
+			Aces //Narkowicz's fit of the ACES filmic curve
 		};
 
-		LightingMode m_CurrentLightingMode{ LightingMode::Combined };
-		bool m_ShadowsEnabled{ true };
+		static constexpr int FRAMEBUFFER_COUNT{ 3 };
+		static constexpr uint32_t MAX_ACCUMULATED_SAMPLES{ 256 };
+		static constexpr int TILE_SIZE{ 16 };
+		//Relative difference between the expected and the stored depth for a reprojected sample to be reused
+		static constexpr float REPROJECTION_DEPTH_TOLERANCE{ .05f };
+		//Relative depth difference up to which a neighbouring block sample contributes when upsampling
+		static constexpr float UPSAMPLE_DEPTH_TOLERANCE{ .1f };
+		//Neighbouring pixels closer than this in normal (cosine) and luminance are not treated as an edge
+		static constexpr float EDGE_NORMAL_THRESHOLD{ .9f };
+		static constexpr float EDGE_LUMINANCE_THRESHOLD{ .1f };
+		static constexpr uint32_t MAX_ANTI_ALIASING_SAMPLES{ 16 };
+		//Distance between the cached and the new hit point, relative to the hit distance
+		static constexpr float CACHE_POSITION_TOLERANCE{ .005f };
+		static constexpr uint32_t CACHE_REFRESH_INTERVAL{ 16 };
+		//First preview level traces one ray per 4x4 pixels
+		static constexpr int MAX_PREVIEW_BLOCK_SIZE{ 4 };
+		//Log2 luminance range of the exposure histogram, darker pixels count as background and are ignored
+		static constexpr int HISTOGRAM_BIN_COUNT{ 64 };
+		static constexpr float MIN_LOG_LUMINANCE{ -10.f };
+		static constexpr float MAX_LOG_LUMINANCE{ 6.f };
+		//Auto-exposure maps the average luminance between these percentiles to middle grey
+		static constexpr float EXPOSURE_LOW_PERCENTILE{ .1f };
+		static constexpr float EXPOSURE_HIGH_PERCENTILE{ .9f };
+		static constexpr float EXPOSURE_KEY{ .18f };
+		//Rate (per second) at which the exposure closes the gap to its target, in stops
+		static constexpr float EXPOSURE_ADAPTATION_RATE{ 3.f };
+		static constexpr float EXPOSURE_CONVERGED_STOPS{ .01f };
+		static constexpr int SCALING_REPETITIONS{ 3 };
+		//Tracing stops at this fraction of the budget, the rest is left for reconstruction, anti-aliasing and output
+		static constexpr float BUDGET_TRACE_FRACTION{ .8f };
+		//Lights picked from the light tree per shading point, with fewer point lights than the minimum all are evaluated
+		static constexpr uint32_t LIGHT_SAMPLE_COUNT{ 4 };
+		static constexpr uint32_t MIN_SAMPLED_LIGHT_COUNT{ 32 };
+		//Sampler dimensions 0 and 1 jitter the pixel position
+		static constexpr uint32_t LIGHT_SAMPLE_DIMENSION{ 2 };
+		//Candidates streamed into a reservoir per pixel, and history reservoirs merged: the reprojected pixel and
+		//its neighbours within the radius (pixels)
+		static constexpr uint32_t RESAMPLING_CANDIDATE_COUNT{ 8 };
+		static constexpr uint32_t RESAMPLING_NEIGHBOUR_COUNT{ 4 };
+		static constexpr float RESAMPLING_RADIUS{ 12.f };
+		//A merged history reservoir counts as at most this many times the candidates of a frame, so old samples fade out
+		static constexpr uint32_t RESAMPLING_HISTORY_LIMIT{ 20 };
+		//Area lights are sampled in a grid of strata, first one per quadrant (on different rows and columns).
+		//Only when those disagree, in a penumbra, the other strata are traced as well.
+		static constexpr uint32_t AREA_LIGHT_GRID_SIZE{ 4 };
+		static constexpr uint32_t AREA_LIGHT_FIRST_STRATA[][2]{ { 0, 0 }, { 2, 1 }, { 1, 2 }, { 3, 3 } };
+		//Jitter of the area light strata, after the light selection and resampling dimensions
+		static constexpr uint32_t AREA_LIGHT_DIMENSION{ 10 };
+		//Ambient occlusion rays reach this far, get this share of the frame budget and scale an ambient light of this intensity
+		static constexpr float AO_RADIUS{ 1.f };
+		static constexpr float AO_BUDGET_FRACTION{ .25f };
+		static constexpr uint32_t AO_MAX_SAMPLES{ 16 };
+		static constexpr float AMBIENT_INTENSITY{ .15f };
+		static constexpr uint32_t AO_DIMENSION{ 12 };
+		//Secondary rays stop at this depth, below the threshold throughput they continue by Russian roulette.
+		//Each depth has one roulette number per branch, the reflected and the transmitted one.
+		static constexpr uint32_t MAX_SPECULAR_DEPTH{ 8 };
+		static constexpr float SPECULAR_ROULETTE_THRESHOLD{ .02f };
+		static constexpr uint32_t SPECULAR_DIMENSION{ 14 };
+		//Paths end after this many bounces, from the roulette bounce on they continue with a probability of their throughput.
+		//Every bounce takes its own group of four dimensions: direction, lobe and roulette.
+		static constexpr uint32_t MAX_PATH_BOUNCES{ 8 };
+		static constexpr uint32_t PATH_ROULETTE_BOUNCE{ 3 };
+		static constexpr float PATH_MAX_SURVIVAL{ .95f };
+		static constexpr uint32_t PATH_DIMENSION{ 32 };
+		static constexpr uint32_t PATH_DIMENSIONS_PER_BOUNCE{ 4 };
+		//Radiance cache cells are about this many pixels wide, lookups are jittered within a cell with two dimensions
+		static constexpr float RADIANCE_CACHE_CELL_PIXELS{ 4.f };
+		static constexpr uint32_t RADIANCE_CACHE_DIMENSION{ 30 };
+		//Box and shadow ray tests over all entries above which moved meshes clear the cache instead of evicting from it, a few ms on one core
+		static constexpr size_t RADIANCE_CACHE_MAX_EVICT_TESTS{ 1 << 17 };
+		//A-trous iterations, with steps of 1, 2, 4... pixels. Neighbours count less with their difference in normal (cosine power),
+		//depth (relative, per pixel of distance), albedo and luminance (relative, the tolerance halves every iteration).
+		static constexpr int DENOISE_ITERATIONS{ 5 };
+		static constexpr int DENOISE_NORMAL_POWER{ 64 }; //A power of two
+		static constexpr float DENOISE_DEPTH_SIGMA{ .01f };
+		static constexpr float DENOISE_ALBEDO_SIGMA{ .1f };
+		static constexpr float DENOISE_LUMINANCE_SIGMA{ 2.f };
+		//Darker albedo channels are divided out at this value, so black surfaces keep their lighting
+		static constexpr float DENOISE_MIN_ALBEDO{ .01f };
+		//Corners of a box and of its extrusion away from the 8 corners of an area light
+		static constexpr int MAX_HULL_POINTS{ 72 };
+
+		//Shading of a pixel's primary hit, kept for the next frame
+		struct CacheSample
+		{
+			Vector3 position{};
+			ColorRGB color{};
+			uint32_t primitiveIndex{};
+			uint32_t age{};
+			bool isValid{ false };
+		};
+
+		//Pixel and sample a light is shaded for, they pick the jitter of the area light samples. Shadow and secondary rays are counted.
+		struct ShadingContext
+		{
+			uint32_t pixelX{};
+			uint32_t pixelY{};
+			uint32_t sampleIndex{};
+			uint32_t nrShadowRays{};
+			uint32_t nrSpecularRays[MAX_SPECULAR_DEPTH]{};
+			uint32_t nrPathRays{};
+		};
+
+		//Light kept by a pixel's resampling: candidates seen, their summed weights and the weight of the kept light.
+		//The surface is stored to reject reservoirs of neighbours on other surfaces.
+		struct Reservoir
+		{
+			Vector3 position{};
+			Vector3 normal{};
+			uint32_t lightIndex{};
+			uint32_t nrCandidates{};
+			float weightSum{};
+			float contributionWeight{};
+		};
+
+		//Lights reaching the part of the view frustum a tile covers, between the nearest and farthest primary hit of its last render
+		struct TileLightList
+		{
+			uint32_t pass{};
+			float minDepth{};
+			float maxDepth{};
+			std::vector<uint32_t> lights{};
+		};
+
+		//Summed over all passes of a frame
+		struct FrameStats
+		{
+			float traceTime{};
+			float reconstructTime{};
+			uint32_t nrPixels{};
+			uint32_t nrCompletedTiles{};
+			uint32_t nrSkippedTiles{};
+			float postTime{};
+		};
+
+		using LuminanceHistogram = std::array<uint32_t, HISTOGRAM_BIN_COUNT>;
+
+		//World AABB of a mesh as it was last rendered
+		struct RenderedMesh
+		{
+			uint32_t version{};
+			Vector3 minAABB{};
+			Vector3 maxAABB{};
+		};
+
+		void RenderPass(const SceneSnapshot& scene);
+		//Filters the color buffer into the denoised buffer
+		void Denoise();
+		void DenoiseTile(uint32_t tileIndex, int stepSize, float luminanceSigma, const std::vector<ColorRGB>& source, std::vector<ColorRGB>& destination) const;
+		const std::vector<ColorRGB>& GetOutputColors() const { return m_IsOutputDenoised ? m_DenoisedBuffer : m_ColorBuffer; }
+		void UpdateLights(const SceneSnapshot& scene);
+		void CullTileLights(const SceneSnapshot& scene, uint32_t tileIndex, const float fov, const float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin);
+		bool IsInLightRange(const Light& light, uint32_t lightIndex, const Vector3& position) const;
+		//Without the shadow test it is the unoccluded contribution, used to weigh resampling candidates
+		ColorRGB ShadeLight(const SceneSnapshot& scene, const HitRecord& closestHit, const Light& light, const Vector3& rayDirection, ShadingContext& context, bool isShadowTested = true) const;
+		//Direct and ambient light of a hit. The tile light lists only apply to primary hits.
+		ColorRGB ShadeDirect(const SceneSnapshot& scene, const HitRecord& closestHit, const Vector3& rayDirection, ShadingContext& context, bool isPrimaryHit) const;
+		//ShadeDirect through the radiance cache, for view independent materials
+		ColorRGB ShadeCachedDirect(const SceneSnapshot& scene, const HitRecord& closestHit, const Vector3& rayDirection, ShadingContext& context, bool isPrimaryHit) const;
+		ColorRGB ShadeAmbient(const SceneSnapshot& scene, const HitRecord& closestHit, const Vector3& rayDirection, const ShadingContext& context) const;
+		//Light arriving through the reflected and transmitted rays of a hit, throughput is the weight of the path up to it
+		ColorRGB ShadeSpecular(const SceneSnapshot& scene, const HitRecord& closestHit, const Vector3& rayDirection, const ColorRGB& throughput, uint32_t depth, ShadingContext& context) const;
+		ColorRGB TraceSpecularRay(const SceneSnapshot& scene, const HitRecord& closestHit, const Vector3& direction, const ColorRGB& weight, const ColorRGB& throughput, uint32_t depth, uint32_t branch, ShadingContext& context) const;
+		//Next-event estimation at every vertex, the bounces importance sample the materials
+		ColorRGB TracePath(const SceneSnapshot& scene, const HitRecord& closestHit, const Vector3& rayDirection, ShadingContext& context) const;
+		//Adds the shadow and secondary rays of a shaded pixel to the frame's counts
+		void CountRays(const ShadingContext& context) const;
+		ColorRGB ShadeAreaLight(const SceneSnapshot& scene, const HitRecord& closestHit, const Light& light, const Vector3& rayDirection, ShadingContext& context, bool isShadowTested) const;
+		//Light arriving from a point (or direction) of a light, lightDirection points from the hit to it.
+		//Calls the kernel of the frame's lighting mode and shadow setting, they are picked once per frame.
+		ColorRGB ShadeLightSample(const SceneSnapshot& scene, const HitRecord& closestHit, const Light& light, const Vector3& lightDirection, const ColorRGB& radiance, const Vector3& rayDirection, ShadingContext& context, bool isShadowTested) const;
+		template<LightingMode lightingMode, bool areShadowsEnabled>
+		ColorRGB ShadeLightSampleKernel(const SceneSnapshot& scene, const HitRecord& closestHit, const Light& light, const Vector3& lightDirection, const ColorRGB& radiance, const Vector3& rayDirection, ShadingContext& context, bool isShadowTested) const;
+		using ShadeLightSampleFunction = ColorRGB(Renderer::*)(const SceneSnapshot&, const HitRecord&, const Light&, const Vector3&, const ColorRGB&, const Vector3&, ShadingContext&, bool) const;
+		static ShadeLightSampleFunction GetShadeLightSampleKernel(LightingMode lightingMode, bool areShadowsEnabled);
+		Ray GetViewRay(float x, float y, const float fov, const float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin) const;
+		ColorRGB TraceCachedPixel(const SceneSnapshot& scene, uint32_t pixelIndex, const Ray& viewRay, GBufferSample& surface, bool& isCacheHit);
+		ColorRGB TraceResampledPixel(const SceneSnapshot& scene, uint32_t pixelIndex, const Ray& viewRay, GBufferSample& surface);
+		//Pixel that saw the given world position in the last rendered frame
+		bool ProjectToHistory(const Vector3& position, uint32_t& historyIndex) const;
+
+		//Fills m_ActiveTiles, returns false when there is nothing to render
+		bool CollectTiles(const SceneSnapshot& scene);
+		void MarkDirtyBox(const SceneSnapshot& scene, const Vector3& minAABB, const Vector3& maxAABB);
+		void MarkDirtyPoints(const SceneSnapshot& scene, const Vector3* pPoints, int nrPoints);
+		bool IsAntiAliasedTile(uint32_t tileIndex) const;
+		void DetectEdges(uint32_t tileIndex);
+		void AntiAliasTile(const SceneSnapshot& scene, uint32_t tileIndex, int gridSize, const float fov, const float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin);
+		void UpdateTileRates();
+		void UpsampleTile(uint32_t tileIndex);
+		void UpsamplePixel(int x, int y, int blockSize);
+		uint32_t GetSamplePixel(int x, int y) const;
+		//Checkerboard parity of the half a tile traced, only for half traced tiles
+		uint32_t GetTracedParity(uint32_t tileIndex) const;
+		void ReconstructTile(uint32_t tileIndex, const float fov, const float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin);
+		void ReconstructPixel(uint32_t pixelIndex, const float fov, const float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin);
+		void ApplyRenderScale();
+		void WriteOutput(std::vector<uint32_t>& frameBuffer);
+		void PackRow(const ColorRGB* pColors, uint32_t* pPixels, int count) const;
+		ColorRGB ToneMap(ColorRGB color) const;
+		LuminanceHistogram BuildTileHistogram(uint32_t tileIndex) const;
+		void UpdateExposure();
+		bool NeedsPostUpdate() const;
+		int GetTileNode(uint32_t tileIndex) const;
+		void UpdateNodeScenes(const SceneSnapshot& scene);
+		template<typename T>
+		void DistributeRows(std::vector<T>& buffer);
+		void HandOverFrame(uint64_t inputTimestamp);
+
+		//Toggled from the main thread while the render thread is tracing
+		std::atomic<LightingMode> m_CurrentLightingMode{ LightingMode::Combined };
+		std::atomic<bool> m_ShadowsEnabled{ true };
+		std::atomic<bool> m_ExhaustiveLighting{ false };
+		std::atomic<bool> m_IsSamplingLights{ false };
+		std::atomic<bool> m_ResampledLighting{ false };
+		std::atomic<bool> m_IsResamplingLights{ false };
+		std::atomic<float> m_RadianceCutoff{};
+		//Counted while shading, which is const otherwise
+		mutable std::atomic<uint64_t> m_FrameLightCount{};
+		mutable std::atomic<uint64_t> m_FrameShadowRayCount{};
+		std::atomic<float> m_LightsPerPixel{};
+		std::atomic<float> m_ShadowRaysPerLight{};
+		std::atomic<bool> m_AmbientOcclusionEnabled{ false };
+		std::atomic<uint32_t> m_AoSampleCount{ 4 };
+		std::atomic<float> m_AoTime{};
+		//Performance counter ticks of the occlusion rays and of all tile work, both summed over the threads
+		mutable std::atomic<uint64_t> m_FrameAoTicks{};
+		mutable std::atomic<uint64_t> m_FrameAoRayCount{};
+		std::atomic<uint64_t> m_FrameTileTicks{};
+		std::atomic<bool> m_SpecularEnabled{ false };
+		std::atomic<bool> m_IsTracingSpecular{ false };
+		std::array<std::atomic<uint32_t>, MAX_SPECULAR_DEPTH> m_SpecularRayCounts{};
+		mutable std::array<std::atomic<uint64_t>, MAX_SPECULAR_DEPTH> m_FrameSpecularRayCounts{};
+		std::atomic<bool> m_IsPathTracing{ false };
+		std::atomic<float> m_PathSamplesPerSecond{};
+		std::atomic<float> m_PathRaysPerSample{};
+		mutable std::atomic<uint64_t> m_FramePathRayCount{};
+		std::atomic<bool> m_AccumulationEnabled{ false };
+		std::atomic<bool> m_IncrementalEnabled{ true };
+		std::atomic<bool> m_ShowTileOverlay{ false };
+		std::atomic<uint32_t> m_SettingsVersion{};
+		std::atomic<float> m_RequestedScale{ 1.f };
+		std::atomic<bool> m_CheckerboardEnabled{ false };
+		std::atomic<float> m_TraceTime{};
+		std::atomic<float> m_ReconstructTime{};
+		std::atomic<uint32_t> m_FrameRayCount{};
+		std::atomic<uint32_t> m_TracedRayCount{};
+		std::atomic<float> m_SamplesPerPixel{};
+		std::atomic<uint32_t> m_AntiAliasingSamples{ 1 };
+		std::atomic<bool> m_ProgressiveEnabled{ true };
+		std::atomic<bool> m_CacheEnabled{ false };
+		std::atomic<uint32_t> m_CacheMaxAge{ 8 };
+		std::atomic<uint32_t> m_FrameCacheHits{};
+		std::atomic<float> m_CacheHitRate{};
+		std::atomic<bool> m_RadianceCacheEnabled{ false };
+		std::atomic<float> m_RadianceCacheHitRate{};
+		mutable std::atomic<uint64_t> m_FrameRadianceLookups{};
+		mutable std::atomic<uint64_t> m_FrameRadianceHits{};
+		std::atomic<uint32_t> m_RadianceEvictCount{};
+		std::atomic<float> m_RadianceEvictTime{};
+		std::atomic<float> m_FrameBudget{ 1.f / 30.f };
+		std::atomic<ToneMapping> m_CurrentToneMapping{ ToneMapping::Clamp };
+		std::atomic<bool> m_AutoExposureEnabled{ false };
+		std::atomic<float> m_ExposureCompensation{};
+		std::atomic<uint32_t> m_PostVersion{};
+		std::atomic<float> m_Exposure{ 1.f };
+		std::atomic<float> m_PostTime{};
+		std::atomic<bool> m_DenoiserEnabled{ false };
+		std::atomic<float> m_DenoiseTime{};
+		std::atomic<SamplerType> m_RequestedSampler{ SamplerType::Sobol };
+		std::atomic<bool> m_BudgetEnabled{ false };
+		std::atomic<float> m_DeadlineHitRate{ 1.f };
+		std::atomic<float> m_TileCompletion{ 1.f };
+		FrameStats m_FrameStats{};
+
+		//Change tracking against the last rendered frame
+		bool m_HasRendered{ false };
+		SceneVersions m_RenderedVersions{};
+		uint32_t m_RenderedSettingsVersion{};
+		std::vector<RenderedMesh> m_RenderedMeshes{};
+		Matrix m_RenderedCameraToWorld{};
+		Vector3 m_RenderedCameraOrigin{};
+		float m_RenderedFov{};
+
+		//Tiles, only the ones in m_ActiveTiles are traced this frame
+		int m_NrTilesX{};
+		int m_NrTilesY{};
+		std::vector<uint32_t> m_ActiveTiles{};
+		std::vector<uint8_t> m_DirtyTiles{};
+		std::atomic<uint32_t> m_RenderedTileCount{};
+
+		//Progressive accumulation: running sum of jittered samples while nothing changes, counted per tile
+		std::vector<ColorRGB> m_AccumulationBuffer{};
+		std::vector<uint32_t> m_TileSampleCounts{};
+		std::atomic<uint32_t> m_SampleCount{};
+		bool m_AccumulateFrame{ false };
+
+		//Checkerboard: changed tiles trace every other pixel and reproject the rest from the previous frame,
+		//the next frame traces the other half if the tile did not change again
+		bool m_CheckerboardFrame{ false };
+		uint32_t m_CheckerboardParity{};
+		//0 for complete tiles, 1 + parity of the traced half otherwise
+		std::vector<uint8_t> m_HalfTracedTiles{};
+		bool m_IsHistoryValid{ false };
+		std::vector<ColorRGB> m_HistoryColorBuffer{};
+		std::vector<GBufferSample> m_HistoryGBuffer{};
+
+		//Variable rate shading: block size per tile this frame and the one its pixels were rendered with
+		std::mutex m_RateMapMutex{};
+		ShadingRateMap m_RateMap{};
+		std::vector<uint8_t> m_TileRates{};
+		std::vector<uint8_t> m_RenderedTileRates{};
+		//Minimum block size of the progressive preview, halved every pass until full rate
+		int m_PreviewBlockSize{ 1 };
+
+		//Hard frame budget: tiles the deadline cut off go first in the next frame. Those cut off before their first sample stay dirty.
+		bool m_BudgetFrame{ false };
+		uint64_t m_TraceDeadline{};
+		std::vector<uint8_t> m_PendingTiles{};
+		uint32_t m_BudgetedFrames{};
+		uint32_t m_DeadlineHits{};
+
+		//Temporal cache, swapped or copied to the history before every pass
+		bool m_CacheFrame{ false };
+		bool m_IsCacheValid{ false };
+		uint32_t m_CacheFrameIndex{};
+		std::vector<CacheSample> m_Cache{};
+		std::vector<CacheSample> m_HistoryCache{};
+
+		//Radiance cache, filled while shading. Pixel footprint is the width of a pixel at unit distance.
+		bool m_RadianceCacheFrame{ false };
+		float m_PixelFootprint{};
+		mutable RadianceCache m_RadianceCache{};
+
+		//Adaptive anti-aliasing: pixels that differ from a neighbour get extra samples after the first pass
+		std::vector<uint8_t> m_EdgeMask{};
 
 		SDL_Window* m_pWindow{};
 
 		SDL_Surface* m_pBuffer{};
-		uint32_t* m_pBufferPixels{};
 
+		//Persistent image at render resolution, tiles that are not re-rendered keep their previous colors.
+		//Converted (and upscaled if needed) to the window resolution by the output stage.
+		std::vector<ColorRGB> m_ColorBuffer{};
+		std::vector<GBufferSample> m_GBuffer{};
+		std::vector<uint32_t> m_OutputRows{};
+		//Window resolution rows of the upscaled image, only used below full render scale
+		std::vector<ColorRGB> m_UpscaleBuffer{};
+		OutputFormat m_OutputFormat{};
+
+		Sampler m_Sampler{};
+
+		//Rebuilt when the lights change, whether lights are sampled is decided once per pass
+		LightTree m_LightTree{};
+		uint32_t m_LightTreeVersion{};
+		size_t m_NrTreeLights{};
+		bool m_IsLightTreeValid{ false };
+		bool m_SampleLightsFrame{ false };
+
+		//Light culling: influence radius per light and a light list per tile, only used by the pass that built it
+		bool m_CullLightsFrame{ false };
+		uint32_t m_LightPass{};
+		std::vector<float> m_LightRadii{};
+		std::vector<TileLightList> m_TileLightLists{};
+
+		//Specialized light sample shading for the frame's lighting mode and shadow setting
+		ShadeLightSampleFunction m_pShadeLightSample{};
+
+		//Rays per hit of the ambient occlusion, fixed for the frame
+		bool m_AoFrame{ false };
+		uint32_t m_AoFrameSamples{};
+
+		//Enabled and the scene has materials with specular parts
+		bool m_SpecularFrame{ false };
+		//Lighting mode of the frame, the key can change the atomic one while tiles are shading
+		LightingMode m_LightingModeFrame{ LightingMode::Combined };
+		//Path tracing always accumulates, and replaces the cache, the resampling and the specular rays
+		bool m_PathTraceFrame{ false };
+
+		//Reservoir resampling, swapped or copied to the history before every pass like the temporal cache
+		bool m_ResampleLightsFrame{ false };
+		uint32_t m_ResampleFrameIndex{};
+		std::vector<Reservoir> m_Reservoirs{};
+		std::vector<Reservoir> m_HistoryReservoirs{};
+
+		WorkerPool* m_pWorkerPool{};
+		//Scene copy per NUMA node, only with a worker pool spanning several nodes
+		std::vector<SceneSnapshot> m_NodeScenes{};
+		bool m_AreNodeScenesValid{ false };
+
+		//Post stage, the exposure adapts in stops over consecutive outputs
+		std::vector<uint32_t> m_TileIndices{};
+		uint32_t m_OutputPostVersion{};
+		ToneMapping m_FrameToneMapping{ ToneMapping::Clamp };
+		float m_FrameExposure{ 1.f };
+		float m_AdaptedStops{};
+		bool m_IsExposureAdapting{ false };
+		uint64_t m_LastExposureUpdate{};
+
+		//Lighting without the albedo, filtered back and forth between the two buffers. Albedos are looked up by material.
+		std::vector<ColorRGB> m_DenoisedBuffer{};
+		std::vector<ColorRGB> m_DenoiseScratch{};
+		std::vector<ColorRGB> m_MaterialAlbedos{};
+		bool m_IsOutputDenoised{ false };
+
+		//Triple buffering: write (render thread), ready (latest completed) and display (main thread)
+		std::vector<uint32_t> m_FrameBuffers[FRAMEBUFFER_COUNT]{};
+		uint64_t m_FrameTimestamps[FRAMEBUFFER_COUNT]{};
+		int m_WriteIndex{ 0 };
+		int m_ReadyIndex{ 1 };
+		int m_DisplayIndex{ 2 };
+		bool m_HasNewFrame{ false };
+
+		std::mutex m_FrameMutex{};
+		std::condition_variable m_FrameCondition{};
+
+		//Render resolution (scaled) and window resolution
 		int m_Width{};
 		int m_Height{};
+		int m_WindowWidth{};
+		int m_WindowHeight{};
 	};
 }
@@ -0,0 +1,233 @@
+#include "Sampler.h"
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+
+using namespace dae;
+
+namespace
+{
+	//Direction numbers of the first four Sobol dimensions (Joe and Kuo), the first one is the van der Corput sequence
+	constexpr std::array<std::array<uint32_t, 32>, 4> CreateSobolDirections()
+	{
+		//Degree, coefficients and initial direction numbers of the primitive polynomials of dimension 1 to 3
+		constexpr uint32_t degrees[]{ 1, 2, 3 };
+		constexpr uint32_t coefficients[]{ 0, 1, 1 };
+		constexpr uint32_t initialNumbers[][3]{ { 1 }, { 1, 3 }, { 1, 3, 1 } };
+
+		std::array<std::array<uint32_t, 32>, 4> directions{};
+		for (uint32_t bit{}; bit < 32; ++bit)
+			directions[0][bit] = 1u << (31 - bit);
+
+		for (uint32_t dimension{ 1 }; dimension < 4; ++dimension)
+		{
+			const uint32_t degree{ degrees[dimension - 1] }, coefficient{ coefficients[dimension - 1] };
+			std::array<uint32_t, 32>& numbers{ directions[dimension] };
+			for (uint32_t bit{}; bit < degree; ++bit)
+				numbers[bit] = initialNumbers[dimension - 1][bit] << (31 - bit);
+
+			for (uint32_t bit{ degree }; bit < 32; ++bit)
+			{
+				numbers[bit] = numbers[bit - degree] ^ (numbers[bit - degree] >> degree);
+				for (uint32_t term{ 1 }; term < degree; ++term)
+					numbers[bit] ^= ((coefficient >> (degree - 1 - term)) & 1) * numbers[bit - term];
+			}
+		}
+		return directions;
+	}
+
+	constexpr std::array<std::array<uint32_t, 32>, 4> SOBOL_DIRECTIONS{ CreateSobolDirections() };
+	//R2 sequence steps (plastic constant), consecutive dimension pairs form a low-discrepancy lattice over the samples
+	constexpr float R2_STEPS[]{ .7548776662f, .5698402910f };
+	constexpr float ONE_MINUS_EPSILON{ 1.f - FLT_EPSILON / 2.f };
+}
+
+Sampler::Sampler(SamplerType type, uint32_t seed) :
+	m_Type(type),
+	m_Seed(seed)
+{
+	GenerateBlueNoise();
+}
+
+float Sampler::Get(uint32_t pixelX, uint32_t pixelY, uint32_t sampleIndex, uint32_t dimension) const
+{
+	switch (m_Type)
+	{
+	case SamplerType::Sobol:
+	{
+		//Burley's shuffled and scrambled Sobol: every pixel visits the sequence in its own order,
+		//groups of four dimensions get their own shuffle so padding dimensions stay independent
+		const uint32_t pixelSeed{ HashCombine(HashCombine(m_Seed, pixelX), pixelY) };
+		const uint32_t groupSeed{ HashCombine(pixelSeed, dimension / SOBOL_DIMENSIONS) };
+		const uint32_t shuffledIndex{ NestedUniformScramble(sampleIndex, groupSeed) };
+		const uint32_t groupDimension{ dimension % SOBOL_DIMENSIONS };
+		return ToUnitFloat(NestedUniformScramble(Sobol(shuffledIndex, groupDimension), HashCombine(groupSeed, groupDimension + 1)));
+	}
+	case SamplerType::BlueNoise:
+	{
+		//Every dimension reads the tile at another offset, consecutive samples rotate the value along the R2 sequence
+		const uint32_t offset{ Hash(HashCombine(m_Seed, dimension)) };
+		const uint32_t mask{ BLUE_NOISE_SIZE - 1 };
+		const uint32_t x{ (pixelX + offset) & mask }, y{ (pixelY + (offset >> 8)) & mask };
+		const float value{ m_BlueNoise[x + y * BLUE_NOISE_SIZE] + sampleIndex * R2_STEPS[dimension % 2] };
+		return std::min(value - floorf(value), ONE_MINUS_EPSILON);
+	}
+	default:
+		return ToUnitFloat(HashCombine(HashCombine(HashCombine(m_Seed, pixelX | pixelY << 16), sampleIndex), dimension));
+	}
+}
+
+const char* Sampler::GetName(SamplerType type)
+{
+	switch (type)
+	{
+	case SamplerType::Sobol: return "Sobol";
+	case SamplerType::BlueNoise: return "BlueNoise";
+	default: return "PCG";
+	}
+}
+
+uint32_t Sampler::Hash(uint32_t value)
+{
+	//PCG RXS-M-XS output permutation
+	const uint32_t state{ value * 747796405u + 2891336453u };
+	const uint32_t word{ ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u };
+	return (word >> 22u) ^ word;
+}
+
+uint32_t Sampler::HashCombine(uint32_t seed, uint32_t value)
+{
+	return Hash(seed ^ (Hash(value) + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+uint32_t Sampler::ReverseBits(uint32_t value)
+{
+	value = (value << 16) | (value >> 16);
+	value = ((value & 0x00ff00ffu) << 8) | ((value & 0xff00ff00u) >> 8);
+	value = ((value & 0x0f0f0f0fu) << 4) | ((value & 0xf0f0f0f0u) >> 4);
+	value = ((value & 0x33333333u) << 2) | ((value & 0xccccccccu) >> 2);
+	return ((value & 0x55555555u) << 1) | ((value & 0xaaaaaaaau) >> 1);
+}
+
+uint32_t Sampler::NestedUniformScramble(uint32_t value, uint32_t seed)
+{
+	//Owen scrambling as a hash that only propagates bits upwards (Laine-Karras), on the reversed bits
+	value = ReverseBits(value);
+	value ^= value * 0x3d20adeau;
+	value += seed;
+	value *= (seed >> 16) | 1u;
+	value ^= value * 0x05526c56u;
+	value ^= value * 0x53a22864u;
+	return ReverseBits(value);
+}
+
+uint32_t Sampler::Sobol(uint32_t index, uint32_t dimension)
+{
+	uint32_t value{};
+	for (uint32_t bit{}; index; index >>= 1, ++bit)
+	{
+		if (index & 1)
+			value ^= SOBOL_DIRECTIONS[dimension][bit];
+	}
+	return value;
+}
+
+float Sampler::ToUnitFloat(uint32_t value)
+{
+	//24 bits fit the mantissa exactly, so the result never rounds up to 1
+	return (value >> 8) * (1.f / 16777216.f);
+}
+
+void Sampler::GenerateBlueNoise()
+{
+	//Void-and-cluster (Ulichney): points are ranked by repeatedly filling the largest void of a toroidal gaussian energy
+	constexpr int size{ BLUE_NOISE_SIZE }, nrPixels{ BLUE_NOISE_SIZE * BLUE_NOISE_SIZE };
+	constexpr int mask{ BLUE_NOISE_SIZE - 1 };
+	constexpr float sigma{ 1.5f };
+
+	std::vector<float> kernel(nrPixels);
+	for (int y{}; y < size; ++y)
+	{
+		for (int x{}; x < size; ++x)
+		{
+			const int distanceX{ std::min(x, size - x) }, distanceY{ std::min(y, size - y) };
+			kernel[x + y * size] = expf(-(distanceX * distanceX + distanceY * distanceY) / (2.f * sigma * sigma));
+		}
+	}
+
+	std::vector<uint8_t> isSet(nrPixels);
+	std::vector<float> energy(nrPixels);
+	auto togglePoint = [&](int index)
+	{
+		isSet[index] ^= 1;
+		const float sign{ isSet[index] ? 1.f : -1.f };
+		const int pointX{ index % size }, pointY{ index / size };
+		for (int y{}; y < size; ++y)
+		{
+			const float* pKernelRow{ kernel.data() + ((y - pointY) & mask) * size };
+			for (int x{}; x < size; ++x)
+				energy[x + y * size] += sign * pKernelRow[(x - pointX) & mask];
+		}
+	};
+	auto findExtreme = [&](uint8_t pointState, bool findHighest)
+	{
+		int bestIndex{ -1 };
+		for (int index{}; index < nrPixels; ++index)
+		{
+			if (isSet[index] != pointState)
+				continue;
+			if (bestIndex < 0 || (findHighest ? energy[index] > energy[bestIndex] : energy[index] < energy[bestIndex]))
+				bestIndex = index;
+		}
+		return bestIndex;
+	};
+	auto findTightestCluster = [&]() { return findExtreme(1, true); };
+	auto findLargestVoid = [&]() { return findExtreme(0, false); };
+
+	//Initial pattern: a tenth of the pixels, relaxed by moving the tightest cluster into the largest void until stable
+	const int nrInitialPoints{ nrPixels / 10 };
+	for (uint32_t attempt{}, nrPoints{}; nrPoints < uint32_t(nrInitialPoints); ++attempt)
+	{
+		const int index{ int(Hash(HashCombine(m_Seed, attempt)) % nrPixels) };
+		if (isSet[index])
+			continue;
+		togglePoint(index);
+		++nrPoints;
+	}
+	for (int iteration{}; iteration < nrPixels; ++iteration)
+	{
+		const int cluster{ findTightestCluster() };
+		togglePoint(cluster);
+		const int largestVoid{ findLargestVoid() };
+		togglePoint(largestVoid);
+		if (largestVoid == cluster)
+			break;
+	}
+
+	std::vector<uint32_t> ranks(nrPixels);
+	const std::vector<uint8_t> initialSet{ isSet };
+	const std::vector<float> initialEnergy{ energy };
+
+	//Initial points ranked from the most to the least clustered one
+	for (int rank{ nrInitialPoints - 1 }; rank >= 0; --rank)
+	{
+		const int cluster{ findTightestCluster() };
+		ranks[cluster] = rank;
+		togglePoint(cluster);
+	}
+
+	//The remaining pixels in the order their voids get filled
+	isSet = initialSet;
+	energy = initialEnergy;
+	for (int rank{ nrInitialPoints }; rank < nrPixels; ++rank)
+	{
+		const int largestVoid{ findLargestVoid() };
+		ranks[largestVoid] = rank;
+		togglePoint(largestVoid);
+	}
+
+	m_BlueNoise.resize(nrPixels);
+	for (int index{}; index < nrPixels; ++index)
+		m_BlueNoise[index] = (ranks[index] + .5f) / nrPixels;
+}
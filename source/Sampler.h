@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace dae
+{
+	enum class SamplerType : uint8_t
+	{
+		Pcg, //Independent hashed random numbers
+		Sobol, //Owen-scrambled Sobol, shuffled per pixel
+		BlueNoise //Tiled blue-noise mask, rotated along the R2 sequence per sample
+	};
+
+	//Deterministic random numbers per pixel, sample and dimension.
+	//Every value is a pure function of its arguments, so all render threads draw from one sampler without locking.
+	class Sampler final
+	{
+	public:
+		explicit Sampler(SamplerType type = SamplerType::Sobol, uint32_t seed = 0);
+		~Sampler() = default;
+
+		Sampler(const Sampler&) = delete;
+		Sampler(Sampler&&) noexcept = delete;
+		Sampler& operator=(const Sampler&) = delete;
+		Sampler& operator=(Sampler&&) noexcept = delete;
+
+		/**
+		 * \brief Random number of one dimension of a sample
+		 * \param dimension consecutive dimensions of the same sample are decorrelated, use 0 and 1 for the pixel position
+		 * \return value in [0, 1)
+		 */
+		float Get(uint32_t pixelX, uint32_t pixelY, uint32_t sampleIndex, uint32_t dimension) const;
+
+		void SetType(SamplerType type) { m_Type = type; }
+		SamplerType GetType() const { return m_Type; }
+		static const char* GetName(SamplerType type);
+
+	private:
+		static constexpr int BLUE_NOISE_SIZE{ 64 };
+		//Sobol dimensions per scrambled group, higher dimensions are padded with differently seeded groups
+		static constexpr uint32_t SOBOL_DIMENSIONS{ 4 };
+
+		static uint32_t Hash(uint32_t value);
+		static uint32_t HashCombine(uint32_t seed, uint32_t value);
+		static uint32_t ReverseBits(uint32_t value);
+		static uint32_t NestedUniformScramble(uint32_t value, uint32_t seed);
+		static uint32_t Sobol(uint32_t index, uint32_t dimension);
+		static float ToUnitFloat(uint32_t value);
+
+		void GenerateBlueNoise();
+
+		SamplerType m_Type;
+		uint32_t m_Seed;
+		//Ranks of a void-and-cluster pattern in (0, 1)
+		std::vector<float> m_BlueNoise{};
+	};
+}
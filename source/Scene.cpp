@@ -4,70 +4,56 @@
 
 namespace dae {
 
-#pragma region Base Scene
-	//Initialize Scene with Default Solid Color Material (RED)
-	Scene::Scene():
-		m_Materials({ new Material_SolidColor({1,0,0})})
-	{
-		m_SphereGeometries.reserve(32);
-		m_PlaneGeometries.reserve(32);
-		m_TriangleMeshGeometries.reserve(32);
-		m_Lights.reserve(32);
-	}
-
-	Scene::~Scene()
-	{
-		for(auto& pMaterial : m_Materials)
-		{
-			delete pMaterial;
-			pMaterial = nullptr;
-		}
-
-		m_Materials.clear();
-	}
-
-	void dae::Scene::GetClosestHit(const Ray& ray, HitRecord& closestHit) const
+#pragma region Scene Snapshot
+	void SceneSnapshot::GetClosestHit(const Ray& ray, HitRecord& closestHit) const
 	{
 		Ray workingRay = ray;
 		float smallestT{ ray.max };
 		HitRecord hit{};
+		uint32_t primitiveIndex{};
 
-		for (const Plane& plane : m_PlaneGeometries)
+		for (const Plane& plane : planeGeometries)
 		{
 			if (GeometryUtils::HitTest_Plane(plane, workingRay, hit) && hit.t < smallestT)
 			{
 				closestHit = hit;
+				closestHit.primitiveIndex = primitiveIndex;
 				smallestT = hit.t;
 				workingRay.max = smallestT;
 			}
+			++primitiveIndex;
 		}
 
-		for (const auto& sphere : m_SphereGeometries)
+		for (const auto& sphere : sphereGeometries)
 		{
 			if (GeometryUtils::HitTest_Sphere(sphere, workingRay, hit) && hit.t < smallestT)
 			{
 				closestHit = hit;
+				closestHit.primitiveIndex = primitiveIndex;
 				smallestT = hit.t;
 				workingRay.max = smallestT;
 			}
+			++primitiveIndex;
 		}
 
-		for (const auto& triangleMesh : m_TriangleMeshGeometries)
+		for (const auto& triangleMesh : triangleMeshGeometries)
 		{
 			if (GeometryUtils::HitTest_TriangleMesh(triangleMesh, workingRay, hit) && hit.t < smallestT)
 			{
 				closestHit = hit;
+				closestHit.primitiveIndex = primitiveIndex;
 				smallestT = hit.t;
 				workingRay.max = smallestT;
 			}
+			++primitiveIndex;
 		}
 	}
 
-	bool Scene::DoesHit(const Ray& ray) const
+	bool SceneSnapshot::DoesHit(const Ray& ray) const
 	{
 		HitRecord hit{};
 
-		for (const Plane& plane : m_PlaneGeometries)
+		for (const Plane& plane : planeGeometries)
 		{
 			if (GeometryUtils::HitTest_Plane(plane, ray, hit, true))
 			{
@@ -75,7 +61,7 @@ namespace dae {
 			}
 		}
 
-		for (const Sphere& sphere : m_SphereGeometries)
+		for (const Sphere& sphere : sphereGeometries)
 		{
 			if (GeometryUtils::HitTest_Sphere(sphere, ray, hit, true))
 			{
@@ -83,7 +69,7 @@ namespace dae {
 			}
 		}
 
-		for (const TriangleMesh& triangleMesh : m_TriangleMeshGeometries)
+		for (const TriangleMesh& triangleMesh : triangleMeshGeometries)
 		{
 			if (GeometryUtils::HitTest_TriangleMesh(triangleMesh, ray, hit, true))
 			{
@@ -93,6 +79,68 @@ namespace dae {
 
 		return false;
 	}
+#pragma endregion
+
+#pragma region Base Scene
+	//Initialize Scene with Default Solid Color Material (RED)
+	Scene::Scene():
+		m_Materials({ new Material_SolidColor({1,0,0})})
+	{
+		m_SphereGeometries.reserve(32);
+		m_PlaneGeometries.reserve(32);
+		m_TriangleMeshGeometries.reserve(32);
+		m_Lights.reserve(32);
+	}
+
+	Scene::~Scene()
+	{
+		for(auto& pMaterial : m_Materials)
+		{
+			delete pMaterial;
+			pMaterial = nullptr;
+		}
+
+		m_Materials.clear();
+	}
+
+	void Scene::CaptureSnapshot(SceneSnapshot& snapshot) const
+	{
+		//Copy assignment keeps the capacity of the recycled snapshot, so no allocations once it has been filled
+		snapshot.planeGeometries = m_PlaneGeometries;
+		snapshot.sphereGeometries = m_SphereGeometries;
+		snapshot.lights = m_Lights;
+		snapshot.materials = m_Materials;
+
+		snapshot.versions.lights = m_LightsVersion;
+		snapshot.versions.materials = m_MaterialsVersion;
+		snapshot.versions.geometry = m_GeometryVersion;
+
+		snapshot.triangleMeshGeometries.resize(m_TriangleMeshGeometries.size());
+		for (size_t meshIndex{}; meshIndex < m_TriangleMeshGeometries.size(); ++meshIndex)
+		{
+			//Only the world space data used by the hit tests, the object space data stays in the scene
+			const TriangleMesh& mesh = m_TriangleMeshGeometries[meshIndex];
+			TriangleMesh& snapshotMesh = snapshot.triangleMeshGeometries[meshIndex];
+
+			snapshotMesh.indices = mesh.indices;
+			snapshotMesh.transformedPositions = mesh.transformedPositions;
+			snapshotMesh.transformedNormals = mesh.transformedNormals;
+			snapshotMesh.transformedMinAABB = mesh.transformedMinAABB;
+			snapshotMesh.transformedMaxAABB = mesh.transformedMaxAABB;
+			snapshotMesh.cullMode = mesh.cullMode;
+			snapshotMesh.materialIndex = mesh.materialIndex;
+			snapshotMesh.worldTransform = mesh.worldTransform;
+			snapshotMesh.version = mesh.version;
+		}
+	}
+
+	void Scene::CaptureCamera(SceneSnapshot& snapshot)
+	{
+		snapshot.cameraToWorld = m_Camera.CalculateCameraToWorld();
+		snapshot.cameraOrigin = m_Camera.origin;
+		snapshot.fovAngle = m_Camera.fovAngle;
+		snapshot.versions.camera = m_Camera.version;
+	}
 
 #pragma region Scene Helpers
 	Sphere* Scene::AddSphere(const Vector3& origin, float radius, unsigned char materialIndex)
@@ -103,6 +151,7 @@ namespace dae {
 		s.materialIndex = materialIndex;
 
 		m_SphereGeometries.emplace_back(s);
+		++m_GeometryVersion;
 		return &m_SphereGeometries.back();
 	}
 
@@ -114,6 +163,7 @@ namespace dae {
 		p.materialIndex = materialIndex;
 
 		m_PlaneGeometries.emplace_back(p);
+		++m_GeometryVersion;
 		return &m_PlaneGeometries.back();
 	}
 
@@ -124,6 +174,7 @@ namespace dae {
 		m.materialIndex = materialIndex;
 
 		m_TriangleMeshGeometries.emplace_back(m);
+		++m_GeometryVersion;
 		return &m_TriangleMeshGeometries.back();
 	}
 
@@ -136,6 +187,7 @@ namespace dae {
 		l.type = LightType::Point;
 
 		m_Lights.emplace_back(l);
+		++m_LightsVersion;
 		return &m_Lights.back();
 	}
 
@@ -148,12 +200,59 @@ namespace dae {
 		l.type = LightType::Directional;
 
 		m_Lights.emplace_back(l);
+		++m_LightsVersion;
+		return &m_Lights.back();
+	}
+
+	Light* Scene::AddSphereLight(const Vector3& origin, float radius, float intensity, const ColorRGB& color)
+	{
+		Light l;
+		l.origin = origin;
+		l.radius = radius;
+		l.intensity = intensity;
+		l.color = color;
+		l.type = LightType::Sphere;
+
+		m_Lights.emplace_back(l);
+		++m_LightsVersion;
+		return &m_Lights.back();
+	}
+
+	Light* Scene::AddRectangleLight(const Vector3& origin, const Vector3& axisU, const Vector3& axisV, float intensity, const ColorRGB& color)
+	{
+		Light l;
+		l.origin = origin;
+		l.direction = Vector3::Cross(axisU, axisV).Normalized();
+		l.axisU = axisU;
+		l.axisV = axisV;
+		l.intensity = intensity;
+		l.color = color;
+		l.type = LightType::Rectangle;
+
+		m_Lights.emplace_back(l);
+		++m_LightsVersion;
+		return &m_Lights.back();
+	}
+
+	Light* Scene::AddDiscLight(const Vector3& origin, const Vector3& normal, float radius, float intensity, const ColorRGB& color)
+	{
+		Light l;
+		l.origin = origin;
+		l.direction = normal.Normalized();
+		l.radius = radius;
+		l.intensity = intensity;
+		l.color = color;
+		l.type = LightType::Disc;
+
+		m_Lights.emplace_back(l);
+		++m_LightsVersion;
 		return &m_Lights.back();
 	}
 
 	unsigned char Scene::AddMaterial(Material* pMaterial)
 	{
 		m_Materials.push_back(pMaterial);
+		++m_MaterialsVersion;
 		return static_cast<unsigned char>(m_Materials.size() - 1);
 	}
 #pragma endregion
@@ -405,4 +504,117 @@ namespace dae {
 		pBunny->UpdateTransforms();
 	}
 #pragma endregion
+
+#pragma region LIGHT RIG SCENE
+	void Scene_LightRig::Initialize()
+	{
+		sceneName = "Light Rig Scene";
+		m_Camera.origin = { 0.f, 3.f, -9.f };
+		m_Camera.fovAngle = 45.f;
+
+		const auto matCT_GrayMediumMetal = AddMaterial(new Material_CookTorrence({ .972f, .960f, .915f }, 1.f, .6f));
+		const auto matCT_GrayMediumPlastic = AddMaterial(new Material_CookTorrence({ .75f, .75f, .75f }, .0f, .6f));
+		const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert({ .49f, .57f, .57f }, 1.f));
+
+		AddPlane({ 0.f,  0.f, 10.f }, { 0.f,  0.f, -1.f }, matLambert_GrayBlue); //back
+		AddPlane({ 0.f,  0.f,  0.f }, { 0.f,  1.f,  0.f }, matLambert_GrayBlue); //bottom
+		AddPlane({ 0.f, 10.f,  0.f }, { 0.f, -1.f,  0.f }, matLambert_GrayBlue); //top
+		AddPlane({ 5.f,  0.f,  0.f }, { -1.f,  0.f,  0.f }, matLambert_GrayBlue); //right
+		AddPlane({ -5.f,  0.f,  0.f }, { 1.f,  0.f,  0.f }, matLambert_GrayBlue); //left
+
+		AddSphere({ -1.75f, 1.f, 0.f }, .75f, matCT_GrayMediumMetal);
+		AddSphere({ 0.f, 1.f, 0.f }, .75f, matCT_GrayMediumPlastic);
+		AddSphere({ 1.75f, 1.f, 0.f }, .75f, matCT_GrayMediumMetal);
+		AddSphere({ -1.75f, 3.f, 0.f }, .75f, matCT_GrayMediumPlastic);
+		AddSphere({ 0.f, 3.f, 0.f }, .75f, matCT_GrayMediumMetal);
+		AddSphere({ 1.75f, 3.f, 0.f }, .75f, matCT_GrayMediumPlastic);
+
+		//Spread through the room along the R3 sequence, the total intensity does not depend on the light count
+		const float intensity{ 150.f / m_NrLights };
+		for (int lightIndex{}; lightIndex < m_NrLights; ++lightIndex)
+		{
+			const float u{ fmodf(.5f + lightIndex * .8191725134f, 1.f) };
+			const float v{ fmodf(.5f + lightIndex * .6710436067f, 1.f) };
+			const float w{ fmodf(.5f + lightIndex * .5497004779f, 1.f) };
+			const ColorRGB color{ .5f + .5f * u, .5f + .5f * w, .5f + .5f * (1.f - u) };
+			AddPointLight({ -4.5f + 9.f * u, .5f + 9.f * v, -8.f + 17.5f * w }, intensity, color);
+		}
+	}
+#pragma endregion
+
+#pragma region AREA LIGHT SCENE
+	void Scene_AreaLights::Initialize()
+	{
+		sceneName = "Area Light Scene";
+		m_Camera.origin = { 0.f, 3.f, -9.f };
+		m_Camera.fovAngle = 45.f;
+
+		const auto matCT_GrayMediumMetal = AddMaterial(new Material_CookTorrence({ .972f, .960f, .915f }, 1.f, .6f));
+		const auto matCT_GrayMediumPlastic = AddMaterial(new Material_CookTorrence({ .75f, .75f, .75f }, .0f, .6f));
+		const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert({ .49f, .57f, .57f }, 1.f));
+
+		AddPlane({ 0.f,  0.f, 10.f }, { 0.f,  0.f, -1.f }, matLambert_GrayBlue); //back
+		AddPlane({ 0.f,  0.f,  0.f }, { 0.f,  1.f,  0.f }, matLambert_GrayBlue); //bottom
+		AddPlane({ 0.f, 10.f,  0.f }, { 0.f, -1.f,  0.f }, matLambert_GrayBlue); //top
+		AddPlane({ 5.f,  0.f,  0.f }, { -1.f,  0.f,  0.f }, matLambert_GrayBlue); //right
+		AddPlane({ -5.f,  0.f,  0.f }, { 1.f,  0.f,  0.f }, matLambert_GrayBlue); //left
+
+		AddSphere({ -1.75f, 1.f, 0.f }, .75f, matCT_GrayMediumMetal);
+		AddSphere({ 0.f, 1.f, 0.f }, .75f, matCT_GrayMediumPlastic);
+		AddSphere({ 1.75f, 1.f, 0.f }, .75f, matCT_GrayMediumMetal);
+		AddSphere({ -1.75f, 3.f, 0.f }, .75f, matCT_GrayMediumPlastic);
+		AddSphere({ 0.f, 3.f, 0.f }, .75f, matCT_GrayMediumMetal);
+		AddSphere({ 1.75f, 3.f, 0.f }, .75f, matCT_GrayMediumPlastic);
+
+		//Light
+		AddSphereLight({ 0.f, 5.f, 5.f }, .75f, 50.f, ColorRGB{ 1.f,.61f,.45f }); //backlight
+		AddRectangleLight({ -2.5f, 5.f, -5.f }, { 1.f, 0.f, 0.f }, { 0.f, .5f, .5f }, 70.f, ColorRGB{ 1.f,.8f,.45f }); //front left
+		AddDiscLight({ 2.5f, 2.5f, -5.f }, { -.25f, 0.f, 1.f }, .5f, 50.f, ColorRGB{ .34f,.47f,.68f }); //front right
+	}
+#pragma endregion
+
+#pragma region GLASS SCENE
+	void Scene_Glass::Initialize()
+	{
+		sceneName = "Glass Scene";
+		m_Camera.origin = { 0.f, 3.f, -9.f };
+		m_Camera.fovAngle = 45.f;
+
+		const auto matCT_GraySmoothMirror = AddMaterial(new Material_CookTorrence({ .972f, .960f, .915f }, 1.f, .1f, 1.f));
+		const auto matCT_GoldMirror = AddMaterial(new Material_CookTorrence({ 1.f, .782f, .344f }, 1.f, .3f, .8f));
+		const auto matCT_GraySmoothPlastic = AddMaterial(new Material_CookTorrence({ .75f,.75f,.75f }, .0f, .1f, 1.f));
+		const auto matGlass = AddMaterial(new Material_Dielectric(colors::White, 1.5f));
+		const auto matGlass_Green = AddMaterial(new Material_Dielectric({ .6f, .9f, .7f }, 1.5f));
+
+		const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert({ .49f, .57f, .57f }, 1.f));
+		const auto matLambert_White = AddMaterial(new Material_Lambert(colors::White, 1.f));
+
+		AddPlane({ 0.f,  0.f, 10.f }, { 0.f,  0.f, -1.f }, matLambert_GrayBlue); //back
+		AddPlane({ 0.f,  0.f,  0.f }, { 0.f,  1.f,  0.f }, matLambert_GrayBlue); //bottom
+		AddPlane({ 0.f, 10.f,  0.f }, { 0.f, -1.f,  0.f }, matLambert_GrayBlue); //top
+		AddPlane({ 5.f,  0.f,  0.f }, { -1.f,  0.f,  0.f }, matCT_GraySmoothMirror); //right
+		AddPlane({ -5.f,  0.f,  0.f }, { 1.f,  0.f,  0.f }, matLambert_GrayBlue); //left
+
+		AddSphere({ -1.75f, 1.f, 0.f }, .75f, matCT_GraySmoothMirror);
+		AddSphere({ 0.f, 1.f, 0.f }, .75f, matGlass);
+		AddSphere({ 1.75f, 1.f, 0.f }, .75f, matCT_GraySmoothPlastic);
+		AddSphere({ -1.75f, 3.f, 0.f }, .75f, matGlass_Green);
+		AddSphere({ 0.f, 3.f, 0.f }, .75f, matLambert_White);
+		AddSphere({ 1.75f, 3.f, 0.f }, .75f, matCT_GoldMirror);
+
+		//Closed mesh, rays inside hit its back faces
+		const auto pCube = AddTriangleMesh(TriangleCullMode::NoCulling, matGlass);
+		Utils::ParseOBJ("Resources/simple_cube.obj", pCube->positions, pCube->normals, pCube->indices);
+		pCube->Scale({ .35f, .35f, .35f });
+		pCube->RotateY(PI_DIV_4);
+		pCube->Translate({ .9f, .35f, -2.f });
+		pCube->UpdateAABB();
+		pCube->UpdateTransforms();
+
+		//Light
+		AddPointLight({ 0.f, 5.f, 5.f }, 50.f, ColorRGB{ 1.f,.61f,.45f }); //backlight
+		AddPointLight({ -2.5f, 5.f, -5.f }, 70.f, ColorRGB{ 1.f,.8f,.45f }); //front left
+		AddPointLight({ 2.5f, 2.5f, -5.f }, 50.f, ColorRGB{ .34f,.47f,.68f }); //front right
+	}
+#pragma endregion
 }
@@ -15,6 +15,36 @@ namespace dae
 	struct Sphere;
 	struct Light;
 
+	//Change counters, together with the TriangleMesh versions a snapshot with the same versions renders the same image
+	struct SceneVersions
+	{
+		uint32_t camera{};
+		uint32_t lights{};
+		uint32_t materials{};
+		uint32_t geometry{};
+
+		bool operator==(const SceneVersions& other) const = default;
+	};
+
+	//Immutable per-frame copy of everything the renderer reads, so the next Scene::Update can run while this one renders
+	struct SceneSnapshot
+	{
+		Vector3 cameraOrigin{};
+		Matrix cameraToWorld{};
+		float fovAngle{ 90.f };
+
+		std::vector<Plane> planeGeometries{};
+		std::vector<Sphere> sphereGeometries{};
+		std::vector<TriangleMesh> triangleMeshGeometries{};
+		std::vector<Light> lights{};
+		std::vector<Material*> materials{};
+
+		SceneVersions versions{};
+
+		void GetClosestHit(const Ray& ray, HitRecord& closestHit) const;
+		bool DoesHit(const Ray& ray) const;
+	};
+
 	//Scene Base Class
 	class Scene
 	{
@@ -28,14 +58,22 @@ namespace dae
 		Scene& operator=(Scene&&) noexcept = delete;
 
 		virtual void Initialize() = 0;
-		virtual void Update(dae::Timer* pTimer)
-		{
-			m_Camera.Update(pTimer);
-		}
+
+		//Animation only, the camera is updated separately (UpdateCamera) right before its frame renders
+		virtual void Update(dae::Timer* /*pTimer*/) {}
+		void UpdateCamera(dae::Timer* pTimer) { m_Camera.Update(pTimer); }
 
 		Camera& GetCamera() { return m_Camera; }
-		void GetClosestHit(const Ray& ray, HitRecord& closestHit) const;
-		bool DoesHit(const Ray& ray) const;
+
+		//Write the current state into a recycled snapshot, reusing its buffers
+		void CaptureSnapshot(SceneSnapshot& snapshot) const;
+		void CaptureCamera(SceneSnapshot& snapshot);
+
+		//Call after editing lights, materials, planes or spheres through their pointers at runtime.
+		//Meshes track themselves through TriangleMesh::UpdateTransforms.
+		void MarkLightsChanged() { ++m_LightsVersion; }
+		void MarkMaterialsChanged() { ++m_MaterialsVersion; }
+		void MarkGeometryChanged() { ++m_GeometryVersion; }
 
 		const std::vector<Plane>& GetPlaneGeometries() const { return m_PlaneGeometries; }
 		const std::vector<Sphere>& GetSphereGeometries() const { return m_SphereGeometries; }
@@ -56,12 +94,20 @@ namespace dae
 
 		Camera m_Camera{};
 
+		uint32_t m_LightsVersion{};
+		uint32_t m_MaterialsVersion{};
+		uint32_t m_GeometryVersion{};
+
 		Sphere* AddSphere(const Vector3& origin, float radius, unsigned char materialIndex = 0);
 		Plane* AddPlane(const Vector3& origin, const Vector3& normal, unsigned char materialIndex = 0);
 		TriangleMesh* AddTriangleMesh(TriangleCullMode cullMode, unsigned char materialIndex = 0);
 
 		Light* AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color);
 		Light* AddDirectionalLight(const Vector3& direction, float intensity, const ColorRGB& color);
+		Light* AddSphereLight(const Vector3& origin, float radius, float intensity, const ColorRGB& color);
+		//Emits on the side of Cross(axisU, axisV), the axes are half edges
+		Light* AddRectangleLight(const Vector3& origin, const Vector3& axisU, const Vector3& axisV, float intensity, const ColorRGB& color);
+		Light* AddDiscLight(const Vector3& origin, const Vector3& normal, float radius, float intensity, const ColorRGB& color);
 		unsigned char AddMaterial(Material* pMaterial);
 	};
 
@@ -168,4 +214,52 @@ namespace dae
 	private:
 		TriangleMesh* pBunny{nullptr};
 	};
+
+	// Light Rig Scene: the reference room lit by many small point lights
+	class Scene_LightRig final : public Scene
+	{
+	public:
+		explicit Scene_LightRig(int nrLights = 256) : m_NrLights{ nrLights } {}
+		~Scene_LightRig() override = default;
+
+		Scene_LightRig(const Scene_LightRig&) = delete;
+		Scene_LightRig(Scene_LightRig&&) noexcept = delete;
+		Scene_LightRig& operator=(const Scene_LightRig&) = delete;
+		Scene_LightRig& operator=(Scene_LightRig&&) noexcept = delete;
+
+		void Initialize() override;
+
+	private:
+		int m_NrLights;
+	};
+
+	// Area Light Scene: the reference room with soft shadows from a sphere, a rectangle and a disc light
+	class Scene_AreaLights final : public Scene
+	{
+	public:
+		Scene_AreaLights() = default;
+		~Scene_AreaLights() override = default;
+
+		Scene_AreaLights(const Scene_AreaLights&) = delete;
+		Scene_AreaLights(Scene_AreaLights&&) noexcept = delete;
+		Scene_AreaLights& operator=(const Scene_AreaLights&) = delete;
+		Scene_AreaLights& operator=(Scene_AreaLights&&) noexcept = delete;
+
+		void Initialize() override;
+	};
+
+	// Glass Scene: the reference room with mirrors, glass spheres and a glass cube, for the specular rays
+	class Scene_Glass final : public Scene
+	{
+	public:
+		Scene_Glass() = default;
+		~Scene_Glass() override = default;
+
+		Scene_Glass(const Scene_Glass&) = delete;
+		Scene_Glass(Scene_Glass&&) noexcept = delete;
+		Scene_Glass& operator=(const Scene_Glass&) = delete;
+		Scene_Glass& operator=(Scene_Glass&&) noexcept = delete;
+
+		void Initialize() override;
+	};
 }
@@ -1,4 +1,5 @@
 #pragma once
+#include <algorithm>
 #include <cassert>
 #include <fstream>
 #include "Math.h"
@@ -74,27 +75,28 @@ namespace dae
 #pragma endregion
 #pragma region Triangle HitTest
 		//TRIANGLE HIT-TESTS
-		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		//Occlusion tests (any hit, no hit record) and the cull mode are template parameters, every combination is its own kernel
+		//without their branches. The overloads without them pick a kernel per triangle, meshes pick one for all of their triangles.
+		template<bool isOcclusionTest, TriangleCullMode cullMode>
+		inline bool HitTest_Triangle(const Vector3& v0, const Vector3& v1, const Vector3& v2, unsigned char materialIndex, const Ray& ray, HitRecord& hitRecord)
 		{
 			// Mller-Trombore - based on https://cadxfem.org/inf/Fast%20MinimumStorage%20RayTriangle%20Intersection.pdf
 			// triangle edges in v0
-			const Vector3 e1v0{ triangle.v1 - triangle.v0 };
-			const Vector3 e2v0{ triangle.v2 - triangle.v0 };
+			const Vector3 e1v0{ v1 - v0 };
+			const Vector3 e2v0{ v2 - v0 };
 
 			const Vector3 n{ Vector3::Cross(e1v0, e2v0) };
 			const float normalRayDot{ Vector3::Dot(n, ray.direction) };
 			if (AreEqual(normalRayDot, 0)) return false; // ray is parrallel to triangle
 
 			// culling is different for shadows
-			if (!ignoreHitRecord)
+			if constexpr (cullMode == TriangleCullMode::BackFaceCulling)
 			{
-				if ((normalRayDot > 0 && triangle.cullMode == TriangleCullMode::BackFaceCulling) ||
-					(normalRayDot < 0 && triangle.cullMode == TriangleCullMode::FrontFaceCulling)) return false;
+				if (isOcclusionTest ? normalRayDot < 0 : normalRayDot > 0) return false;
 			}
-			else
+			else if constexpr (cullMode == TriangleCullMode::FrontFaceCulling)
 			{
-				if ((normalRayDot < 0 && triangle.cullMode == TriangleCullMode::BackFaceCulling) ||
-					(normalRayDot > 0 && triangle.cullMode == TriangleCullMode::FrontFaceCulling)) return false;
+				if (isOcclusionTest ? normalRayDot > 0 : normalRayDot < 0) return false;
 			}
 
 			// calc determinant
@@ -105,7 +107,7 @@ namespace dae
 
 			const float inverseDeterminant{ 1 / determinant };
 
-			const Vector3 tvec{ ray.origin - triangle.v0 };
+			const Vector3 tvec{ ray.origin - v0 };
 			const float u{ Vector3::Dot(tvec, pvec) * inverseDeterminant };
 			if (u < 0 || u > 1) return false;
 
@@ -118,7 +120,7 @@ namespace dae
 			// check if t in limits
 			if (t < ray.min || t > ray.max) return false;
 
-			if (ignoreHitRecord)
+			if constexpr (isOcclusionTest)
 			{
 				hitRecord.didHit = true;
 				hitRecord.t = 0;
@@ -127,7 +129,7 @@ namespace dae
 
 			//hit record
 			hitRecord.didHit = true;
-			hitRecord.materialIndex = triangle.materialIndex;
+			hitRecord.materialIndex = materialIndex;
 			hitRecord.normal = n.Normalized();
 			hitRecord.t = t;
 			hitRecord.origin = ray.origin + t * ray.direction;
@@ -135,10 +137,29 @@ namespace dae
 			return true;
 		}
 
+		template<bool isOcclusionTest>
+		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitRecord& hitRecord)
+		{
+			switch (triangle.cullMode)
+			{
+			case TriangleCullMode::FrontFaceCulling:
+				return HitTest_Triangle<isOcclusionTest, TriangleCullMode::FrontFaceCulling>(triangle.v0, triangle.v1, triangle.v2, triangle.materialIndex, ray, hitRecord);
+			case TriangleCullMode::BackFaceCulling:
+				return HitTest_Triangle<isOcclusionTest, TriangleCullMode::BackFaceCulling>(triangle.v0, triangle.v1, triangle.v2, triangle.materialIndex, ray, hitRecord);
+			default:
+				return HitTest_Triangle<isOcclusionTest, TriangleCullMode::NoCulling>(triangle.v0, triangle.v1, triangle.v2, triangle.materialIndex, ray, hitRecord);
+			}
+		}
+
+		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			return ignoreHitRecord ? HitTest_Triangle<true>(triangle, ray, hitRecord) : HitTest_Triangle<false>(triangle, ray, hitRecord);
+		}
+
 		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray)
 		{
 			HitRecord temp{};
-			return HitTest_Triangle(triangle, ray, temp, true);
+			return HitTest_Triangle<true>(triangle, ray, temp);
 		}
 #pragma endregion
 #pragma region TriangeMesh HitTest
@@ -165,7 +186,8 @@ namespace dae
 			return tmax > 0 && tmax >= tmin;
 		}
 
-		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		template<bool isOcclusionTest, TriangleCullMode cullMode>
+		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord)
 		{
 			// slabtest
 			if (!SlabTest(mesh.transformedMinAABB, mesh.transformedMaxAABB, ray)) return false;
@@ -174,12 +196,14 @@ namespace dae
 
 			for (int i{}; i < mesh.indices.size(); i+=3)
 			{
-				Triangle triangle{ mesh.transformedPositions[mesh.indices[i]], mesh.transformedPositions[mesh.indices[i + 1]], mesh.transformedPositions[mesh.indices[i + 2]], Vector3{} };
-				triangle.cullMode = mesh.cullMode;
-				triangle.materialIndex = mesh.materialIndex;
+				const Vector3& v0{ mesh.transformedPositions[mesh.indices[i]] };
+				const Vector3& v1{ mesh.transformedPositions[mesh.indices[i + 1]] };
+				const Vector3& v2{ mesh.transformedPositions[mesh.indices[i + 2]] };
 
-				if (HitTest_Triangle(triangle, workingRay, hitRecord, ignoreHitRecord))
+				if (HitTest_Triangle<isOcclusionTest, cullMode>(v0, v1, v2, mesh.materialIndex, workingRay, hitRecord))
 				{
+					// any hit is enough to occlude
+					if constexpr (isOcclusionTest) return true;
 					workingRay.max = hitRecord.t;
 				}
 			}
@@ -189,6 +213,22 @@ namespace dae
 			return true;
 		}
 
+		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			switch (mesh.cullMode)
+			{
+			case TriangleCullMode::FrontFaceCulling:
+				return ignoreHitRecord ? HitTest_TriangleMesh<true, TriangleCullMode::FrontFaceCulling>(mesh, ray, hitRecord) :
+					HitTest_TriangleMesh<false, TriangleCullMode::FrontFaceCulling>(mesh, ray, hitRecord);
+			case TriangleCullMode::BackFaceCulling:
+				return ignoreHitRecord ? HitTest_TriangleMesh<true, TriangleCullMode::BackFaceCulling>(mesh, ray, hitRecord) :
+					HitTest_TriangleMesh<false, TriangleCullMode::BackFaceCulling>(mesh, ray, hitRecord);
+			default:
+				return ignoreHitRecord ? HitTest_TriangleMesh<true, TriangleCullMode::NoCulling>(mesh, ray, hitRecord) :
+					HitTest_TriangleMesh<false, TriangleCullMode::NoCulling>(mesh, ray, hitRecord);
+			}
+		}
+
 		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
 		{
 			HitRecord temp{};
@@ -197,6 +237,39 @@ namespace dae
 #pragma endregion
 	}
 
+	namespace SamplingUtils
+	{
+		//Shirley-Chiu concentric mapping of u and v in [0, 1) onto the unit disc, neighbouring strata stay neighbours
+		inline void SampleConcentricDisc(float u, float v, float& x, float& y)
+		{
+			u = 2.f * u - 1.f;
+			v = 2.f * v - 1.f;
+
+			float radius{}, angle{};
+			if (fabsf(u) > fabsf(v)) { radius = u; angle = PI_DIV_4 * (v / u); }
+			else if (v != 0.f) { radius = v; angle = PI_DIV_2 - PI_DIV_4 * (u / v); }
+			x = radius * cosf(angle);
+			y = radius * sinf(angle);
+		}
+
+		//Any two unit vectors perpendicular to the normal and to each other
+		inline void GetTangentFrame(const Vector3& normal, Vector3& tangent, Vector3& bitangent)
+		{
+			tangent = Vector3::Cross(fabsf(normal.x) > .9f ? Vector3::UnitY : Vector3::UnitX, normal).Normalized();
+			bitangent = Vector3::Cross(normal, tangent);
+		}
+
+		//Direction around the normal with a probability of cos / PI: a disc sample lifted onto the hemisphere (Malley)
+		inline Vector3 SampleCosineHemisphere(const Vector3& normal, float u, float v)
+		{
+			float x{}, y{};
+			SampleConcentricDisc(u, v, x, y);
+			Vector3 tangent{}, bitangent{};
+			GetTangentFrame(normal, tangent, bitangent);
+			return tangent * x + bitangent * y + normal * sqrtf(std::max(1.f - x * x - y * y, 0.f));
+		}
+	}
+
 	namespace LightUtils
 	{
 		//Direction from target to light
@@ -209,10 +282,25 @@ namespace dae
 			case LightType::Directional:
 				return {light.direction};
 			default:
-				return{};
+				return { light.origin - origin };
 			}
 		}
 
+		//Radiance arriving at the target from one point of an area light
+		inline ColorRGB GetRadiance(const Light& light, const Vector3& target, const Vector3& lightPoint)
+		{
+			const Vector3 radius{ lightPoint - target };
+			const float sqrDistance{ Vector3::Dot(radius, radius) };
+			if (light.type == LightType::Sphere)
+				return { light.color * (light.intensity / sqrDistance) };
+
+			//One-sided emitters
+			const float cosine{ -Vector3::Dot(light.direction, radius) / sqrtf(sqrDistance) };
+			if (cosine <= 0.f)
+				return {};
+			return { light.color * (light.intensity * cosine / sqrDistance) };
+		}
+
 		inline ColorRGB GetRadiance(const Light& light, const Vector3& target)
 		{
 			const Vector3 radius{ light.origin - target };
@@ -224,9 +312,38 @@ namespace dae
 			case LightType::Directional:
 				return { light.color * light.intensity };
 			default:
-				return{};
+				return GetRadiance(light, target, light.origin);
 			}
 		}
+
+		//Half the size of the light, zero for point and directional lights
+		inline float GetExtent(const Light& light)
+		{
+			switch (light.type)
+			{
+			case LightType::Sphere:
+			case LightType::Disc:
+				return light.radius;
+			case LightType::Rectangle:
+				return (light.axisU + light.axisV).Magnitude();
+			default:
+				return 0.f;
+			}
+		}
+
+		//Point on an area light for u and v in [0, 1). Spheres are sampled on their outline as seen from the target.
+		inline Vector3 SampleAreaLight(const Light& light, const Vector3& target, float u, float v)
+		{
+			if (light.type == LightType::Rectangle)
+				return light.origin + light.axisU * (2.f * u - 1.f) + light.axisV * (2.f * v - 1.f);
+
+			float x{}, y{};
+			SamplingUtils::SampleConcentricDisc(u, v, x, y);
+			const Vector3 normal{ light.type == LightType::Disc ? light.direction : (target - light.origin).Normalized() };
+			Vector3 tangent{}, bitangent{};
+			SamplingUtils::GetTangentFrame(normal, tangent, bitangent);
+			return light.origin + (tangent * x + bitangent * y) * light.radius;
+		}
 	}
 
 	namespace Utils
@@ -0,0 +1,136 @@
+#include "WorkerPool.h"
+#include <algorithm>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+using namespace dae;
+
+namespace
+{
+	int CountNodes(const std::vector<LogicalCpu>& cpus)
+	{
+		int nrNodes{ 1 };
+		for (const LogicalCpu& cpu : cpus)
+			nrNodes = std::max(nrNodes, cpu.node + 1);
+		return nrNodes;
+	}
+}
+
+WorkerPool::WorkerPool(const std::vector<LogicalCpu>& cpus) :
+	m_NrNodes(CountNodes(cpus)),
+	m_NodeNext(CountNodes(cpus))
+{
+	m_NodeQueues.resize(m_NrNodes);
+
+	//Without CPUs a single unpinned worker still gets the work done
+	m_Workers.resize(std::max(cpus.size(), size_t(1)));
+	for (int workerIndex{}; workerIndex < int(m_Workers.size()); ++workerIndex)
+	{
+		Worker& worker{ m_Workers[workerIndex] };
+		worker.cpu = cpus.empty() ? -1 : cpus[workerIndex].id;
+		worker.node = cpus.empty() ? 0 : cpus[workerIndex].node;
+		worker.thread = std::thread(&WorkerPool::Run, this, workerIndex);
+		if (worker.cpu >= 0)
+			PinThread(worker.thread, worker.cpu);
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard lock{ m_Mutex };
+		m_IsRunning = false;
+	}
+	m_StartCondition.notify_all();
+
+	for (Worker& worker : m_Workers)
+	{
+		if (worker.thread.joinable())
+			worker.thread.join();
+	}
+}
+
+void WorkerPool::ForEach(uint32_t count, const std::function<int(uint32_t)>& getNode, const std::function<void(uint32_t, int)>& task, bool allowStealing)
+{
+	if (count == 0)
+		return;
+
+	std::unique_lock lock{ m_Mutex };
+	for (int node{}; node < m_NrNodes; ++node)
+	{
+		m_NodeQueues[node].clear();
+		m_NodeNext[node] = 0;
+	}
+	for (uint32_t index{}; index < count; ++index)
+		m_NodeQueues[std::clamp(getNode(index), 0, m_NrNodes - 1)].push_back(index);
+
+	m_pTask = &task;
+	m_AllowStealing = allowStealing;
+	m_NrBusyWorkers = int(m_Workers.size());
+	++m_Generation;
+	m_StartCondition.notify_all();
+
+	m_DoneCondition.wait(lock, [this]() { return m_NrBusyWorkers == 0; });
+	m_pTask = nullptr;
+}
+
+void WorkerPool::RunOnEachNode(const std::function<void(int)>& task)
+{
+	ForEach(uint32_t(m_NrNodes), [](uint32_t index) { return int(index); }, [&task](uint32_t, int node) { task(node); }, false);
+}
+
+void WorkerPool::Run(int workerIndex)
+{
+	const int ownNode{ m_Workers[workerIndex].node };
+	uint64_t handledGeneration{};
+
+	while (true)
+	{
+		{
+			std::unique_lock lock{ m_Mutex };
+			m_StartCondition.wait(lock, [&]() { return !m_IsRunning || m_Generation != handledGeneration; });
+			if (!m_IsRunning)
+				return;
+			handledGeneration = m_Generation;
+		}
+
+		//Own node first, then the others in order
+		for (int offset{}; offset < m_NrNodes; ++offset)
+		{
+			if (offset > 0 && !m_AllowStealing)
+				break;
+
+			const int node{ (ownNode + offset) % m_NrNodes };
+			const std::vector<uint32_t>& queue{ m_NodeQueues[node] };
+			for (uint32_t next{ m_NodeNext[node]++ }; next < queue.size(); next = m_NodeNext[node]++)
+				(*m_pTask)(queue[next], ownNode);
+		}
+
+		std::lock_guard lock{ m_Mutex };
+		if (--m_NrBusyWorkers == 0)
+			m_DoneCondition.notify_one();
+	}
+}
+
+void WorkerPool::PinThread(std::thread& thread, int cpu)
+{
+#if defined(__linux__)
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	CPU_SET(cpu, &cpuSet);
+	pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuSet);
+#elif defined(_WIN32)
+	//Affinity masks only cover the first processor group
+	if (cpu < 64)
+		SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << cpu);
+#else
+	(void)thread;
+	(void)cpu;
+#endif
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "CpuTopology.h"
+
+namespace dae
+{
+	//Render workers pinned to fixed CPUs, an alternative to std::execution::par when placement matters.
+	//Every index goes to a queue of its preferred node first, workers that run out of local work steal from other nodes.
+	class WorkerPool final
+	{
+	public:
+		explicit WorkerPool(const std::vector<LogicalCpu>& cpus);
+		~WorkerPool();
+
+		WorkerPool(const WorkerPool&) = delete;
+		WorkerPool(WorkerPool&&) noexcept = delete;
+		WorkerPool& operator=(const WorkerPool&) = delete;
+		WorkerPool& operator=(WorkerPool&&) noexcept = delete;
+
+		/**
+		 * \brief Calls task(index, node) for every index in [0, count) and blocks until all are done
+		 * \param getNode node whose workers should handle the index, e.g. the one holding its memory
+		 * \param allowStealing false keeps every index on its node, even when other workers are idle
+		 */
+		void ForEach(uint32_t count, const std::function<int(uint32_t)>& getNode, const std::function<void(uint32_t, int)>& task, bool allowStealing = true);
+		//Calls task(node) once on a worker of every node
+		void RunOnEachNode(const std::function<void(int)>& task);
+
+		int GetWorkerCount() const { return int(m_Workers.size()); }
+		int GetNodeCount() const { return m_NrNodes; }
+
+	private:
+		struct Worker
+		{
+			std::thread thread{};
+			int cpu{};
+			int node{};
+		};
+
+		void Run(int workerIndex);
+		static void PinThread(std::thread& thread, int cpu);
+
+		std::vector<Worker> m_Workers{};
+		int m_NrNodes{ 1 };
+
+		std::mutex m_Mutex{};
+		std::condition_variable m_StartCondition{};
+		std::condition_variable m_DoneCondition{};
+		bool m_IsRunning{ true };
+		uint64_t m_Generation{};
+		int m_NrBusyWorkers{};
+
+		//Current job, only changed while no worker is busy
+		std::vector<std::vector<uint32_t>> m_NodeQueues{};
+		std::vector<std::atomic<uint32_t>> m_NodeNext;
+		const std::function<void(uint32_t, int)>* m_pTask{};
+		bool m_AllowStealing{ true };
+	};
+}
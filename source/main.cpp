@@ -6,11 +6,15 @@
 
 //Standard includes
 #include <iostream>
+#include <string>
 
 //Project includes
 #include "Timer.h"
 #include "Renderer.h"
+#include "RenderThread.h"
 #include "Scene.h"
+#include "CpuTopology.h"
+#include "WorkerPool.h"
 
 using namespace dae;
 
@@ -22,10 +26,6 @@ void ShutDown(SDL_Window* pWindow)
 
 int main(int argc, char* args[])
 {
-	//Unreferenced parameters
-	(void)argc;
-	(void)args;
-
 	//Create window + surfaces
 	SDL_Init(SDL_INIT_VIDEO);
 
@@ -48,15 +48,40 @@ int main(int argc, char* args[])
 	const auto pScene = new Scene_BunnyScene();
 	pScene->Initialize();
 
+	//--pin: render workers pinned to every logical CPU, --pin-physical: one per physical core (no SMT siblings)
+	WorkerPool* pWorkerPool = nullptr;
+	for (int argIndex = 1; argIndex < argc; ++argIndex)
+	{
+		const std::string argument = args[argIndex];
+		if (argument != "--pin" && argument != "--pin-physical")
+			continue;
+
+		const CpuTopology topology = CpuTopology::Detect();
+		delete pWorkerPool;
+		pWorkerPool = new WorkerPool(topology.GetWorkerCpus(argument == "--pin-physical"));
+		pRenderer->SetWorkerPool(pWorkerPool);
+		std::cout << "Pinned " << pWorkerPool->GetWorkerCount() << " render workers on " << pWorkerPool->GetNodeCount() << " NUMA node(s)" << std::endl;
+	}
+
 	//Start loop
 	pTimer->Start();
 
 	// Start Benchmark
 	// pTimer->StartBenchmark();
 
+	//Rendering runs on its own thread, this thread only handles input and presents finished frames
+	const auto pRenderThread = new RenderThread(pRenderer, pScene, pTimer);
+	pRenderThread->GetDynamicResolution().SetTargetFrameTime(1.f / 30.f);
+	pRenderThread->Start();
+
 	float printTimer = 0.f;
+	uint64_t previousTime = SDL_GetPerformanceCounter();
+	const float secondsPerCount = 1.f / static_cast<float>(SDL_GetPerformanceFrequency());
+
 	bool isLooping = true;
 	bool takeScreenshot = false;
+	bool isFoveated = false;
+	int focusX = -1, focusY = -1;
 	while (isLooping)
 	{
 		//--------- Get input events ---------
@@ -71,30 +96,118 @@ int main(int argc, char* args[])
 			case SDL_KEYUP:
 				if(e.key.keysym.scancode == SDL_SCANCODE_X)
 					takeScreenshot = true;
+				if (e.key.keysym.scancode == SDL_SCANCODE_F1) pRenderer->ToggleTemporalCache();
 				if (e.key.keysym.scancode == SDL_SCANCODE_F2) pRenderer->ToggleShadows();
 				if (e.key.keysym.scancode == SDL_SCANCODE_F3) pRenderer->CycleLightingMode();
-				if (e.key.keysym.scancode == SDL_SCANCODE_F6) pTimer->StartBenchmark();
+				if (e.key.keysym.scancode == SDL_SCANCODE_F4) pRenderer->ToggleAccumulation();
+				if (e.key.keysym.scancode == SDL_SCANCODE_F5) pRenderer->ToggleTileOverlay();
+				if (e.key.keysym.scancode == SDL_SCANCODE_F7) pRenderer->ToggleIncrementalRendering();
+				if (e.key.keysym.scancode == SDL_SCANCODE_F6) pRenderThread->RequestBenchmark();
+				if (e.key.keysym.scancode == SDL_SCANCODE_F8) pRenderThread->ToggleDynamicResolution();
+				if (e.key.keysym.scancode == SDL_SCANCODE_F9) pRenderer->ToggleCheckerboard();
+				if (e.key.keysym.scancode == SDL_SCANCODE_F10)
+				{
+					isFoveated = !isFoveated;
+					focusX = focusY = -1;
+					if (!isFoveated) pRenderer->SetShadingRateMap({});
+				}
+				if (e.key.keysym.scancode == SDL_SCANCODE_F11) pRenderer->CycleAntiAliasing();
+				if (e.key.keysym.scancode == SDL_SCANCODE_F12) pRenderer->ToggleProgressivePreview();
+				if (e.key.keysym.scancode == SDL_SCANCODE_T) pRenderer->CycleToneMapping();
+				if (e.key.keysym.scancode == SDL_SCANCODE_E) pRenderer->ToggleAutoExposure();
+				if (e.key.keysym.scancode == SDL_SCANCODE_PAGEUP) pRenderer->AdjustExposure(.5f);
+				if (e.key.keysym.scancode == SDL_SCANCODE_PAGEDOWN) pRenderer->AdjustExposure(-.5f);
+				if (e.key.keysym.scancode == SDL_SCANCODE_N) pRenderer->CycleSampler();
+				if (e.key.keysym.scancode == SDL_SCANCODE_B) pRenderThread->RequestConvergenceBenchmark();
+				if (e.key.keysym.scancode == SDL_SCANCODE_P) pRenderThread->RequestScalingBenchmark();
+				if (e.key.keysym.scancode == SDL_SCANCODE_G) pRenderer->ToggleBudgetedRendering();
+				if (e.key.keysym.scancode == SDL_SCANCODE_L) pRenderer->ToggleExhaustiveLighting();
+				if (e.key.keysym.scancode == SDL_SCANCODE_K) pRenderer->SetRadianceCutoff(pRenderer->GetRadianceCutoff() > 0.f ? 0.f : .01f);
+				if (e.key.keysym.scancode == SDL_SCANCODE_R) pRenderer->ToggleResampledLighting();
+				if (e.key.keysym.scancode == SDL_SCANCODE_O) pRenderer->ToggleAmbientOcclusion();
+				if (e.key.keysym.scancode == SDL_SCANCODE_M) pRenderer->ToggleSpecularRays();
+				if (e.key.keysym.scancode == SDL_SCANCODE_F) pRenderer->ToggleDenoiser();
+				if (e.key.keysym.scancode == SDL_SCANCODE_H) pRenderer->ToggleRadianceCache();
 				break;
 			}
 		}
 
-		//--------- Update ---------
-		pScene->Update(pTimer);
+		//--------- Input ---------
+		pRenderThread->SubmitInput(CameraInput::Sample());
 
-		//--------- Render ---------
-		pRenderer->Render(pScene);
+		//Foveated shading follows the mouse cursor, one rate per 16x16 pixels
+		if (isFoveated)
+		{
+			int mouseX{}, mouseY{};
+			SDL_GetMouseState(&mouseX, &mouseY);
+			if (mouseX != focusX || mouseY != focusY)
+			{
+				focusX = mouseX;
+				focusY = mouseY;
+				pRenderer->SetShadingRateMap(ShadingRateMap::CreateFoveated(width / 16, height / 16,
+					focusX / float(width), focusY / float(height), .2f, .4f));
+			}
+		}
 
-		//--------- Timer ---------
-		pTimer->Update();
-		printTimer += pTimer->GetElapsed();
+		//--------- Present ---------
+		//Short timeout so input keeps getting polled while a frame is being traced
+		const bool presented = pRenderThread->Present(4);
+
+		//--------- Stats ---------
+		const uint64_t currentTime = SDL_GetPerformanceCounter();
+		printTimer += (currentTime - previousTime) * secondsPerCount;
+		previousTime = currentTime;
 		if (printTimer >= 1.f)
 		{
 			printTimer = 0.f;
-			std::cout << "dFPS: " << pTimer->GetdFPS() << std::endl;
+			std::cout << "dFPS: " << pRenderThread->GetRenderFPS()
+				<< " | present FPS: " << pRenderThread->GetPresentFPS()
+				<< " | latency: " << pRenderThread->GetAverageLatency() * 1000.f << " ms"
+				<< " | tiles: " << pRenderer->GetRenderedTileCount() << "/" << pRenderer->GetTileCount()
+				<< " | rays: " << pRenderer->GetTracedRayCount() << " (" << pRenderer->GetSamplesPerPixel() << " spp)"
+				<< " | trace: " << pRenderer->GetTraceTime() * 1000.f << " ms";
+			if (pRenderer->IsCheckerboarding() || isFoveated)
+				std::cout << " | reconstruct: " << pRenderer->GetReconstructTime() * 1000.f << " ms";
+			std::cout << " | post: " << pRenderer->GetPostTime() * 1000.f << " ms";
+			if (pRenderer->IsDenoising())
+				std::cout << " (denoise: " << pRenderer->GetDenoiseTime() * 1000.f << " ms)";
+			if (pRenderer->IsAutoExposing())
+				std::cout << " | exposure: " << pRenderer->GetExposure();
+			if (pRenderer->IsBudgeted())
+				std::cout << " | budget: hit " << pRenderer->GetDeadlineHitRate() * 100.f << "%, tiles " << pRenderer->GetTileCompletion() * 100.f << "%";
+			std::cout << " | lights/px: " << pRenderer->GetLightsPerPixel();
+			if (pRenderer->IsResamplingLights())
+				std::cout << " (resampled)";
+			else if (pRenderer->IsSamplingLights())
+				std::cout << " (sampled)";
+			std::cout << " | shadow rays/light: " << pRenderer->GetShadowRaysPerLight();
+			if (pRenderer->IsAmbientOcclusionEnabled())
+				std::cout << " | AO: " << pRenderer->GetAmbientOcclusionTime() * 1000.f << " ms (" << pRenderer->GetAmbientOcclusionSamples() << " rays)";
+			if (pRenderer->IsTracingSpecular())
+			{
+				std::cout << " | specular rays/depth:";
+				for (const uint32_t count : pRenderer->GetSpecularRayCounts())
+					std::cout << ' ' << count;
+			}
+			if (pRenderer->IsPathTracing())
+				std::cout << " | path: " << pRenderer->GetPathSamplesPerSecond() << " samples/s, " << pRenderer->GetPathRaysPerSample() << " rays/sample";
+			if (pRenderer->IsCaching())
+				std::cout << " | cache: " << pRenderer->GetCacheHitRate() * 100.f << "%";
+			if (pRenderer->IsRadianceCaching())
+				std::cout << " | radiance cache: " << pRenderer->GetRadianceCacheHitRate() * 100.f << "% hits, "
+					<< pRenderer->GetRadianceCacheEntryCount() << " entries, " << pRenderer->GetRadianceCacheMemory() / (1024.f * 1024.f) << " MB, "
+					<< pRenderer->GetRadianceCacheEvictCount() << " evicted in " << pRenderer->GetRadianceCacheEvictTime() * 1000.f << " ms";
+			if (pRenderThread->IsDynamicResolutionEnabled())
+				std::cout << " | scale: " << pRenderer->GetRenderScale();
+			if (pRenderer->IsAccumulating())
+				std::cout << " | samples: " << pRenderer->GetSampleCount() << " (" << pRenderer->GetSamplerName() << ")";
+			if (pRenderThread->IsIdle())
+				std::cout << " | idle";
+			std::cout << std::endl;
 		}
 
 		//Save screenshot after full render
-		if (takeScreenshot)
+		if (takeScreenshot && presented)
 		{
 			if (!pRenderer->SaveBufferToImage())
 				std::cout << "Screenshot saved!" << std::endl;
@@ -103,9 +216,12 @@ int main(int argc, char* args[])
 			takeScreenshot = false;
 		}
 	}
+	pRenderThread->Stop();
 	pTimer->Stop();
 
 	//Shutdown "framework"
+	delete pRenderThread;
+	delete pWorkerPool;
 	delete pScene;
 	delete pRenderer;
 	delete pTimer;